@@ -0,0 +1,468 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+// Copyright (C) 2025 R. Moeijes
+
+/** @file ap_setup.c
+ * @brief Native access point bring-up and tear-down
+ * @author R. Moeijes
+ * @date 2025
+ * @version 1.0.0
+ * @copyright GPL v2+
+ *
+ * Replaces the sysctl/iptables/ip calls of StartAP, which cost a fork
+ * each. Sysctls are written to /proc directly, the interface is set up
+ * over rtnetlink and the firewall is one atomic nftables transaction
+ * (a single `nft -f -`). Addressing and firewall run on separate
+ * threads since they do not depend on each other.
+ *
+ * Everything is keyed on the configured interface names, so it can be
+ * tried in a network namespace:
+ *   unshare -n sh -c 'ip link add wlan0 type dummy; simple-wifi --bring-up'
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <spawn.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+#include <net/if.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+
+#include "ap_setup.h"
+
+#define NL_BUFSIZE 8192
+#define MAX_FLUSH_ADDRS 16
+
+extern char **environ;
+
+/* Timing of one step, printed when all are done */
+struct ap_phase {
+	const char *name;
+	double ms;
+	int ret;
+};
+
+struct ap_job {
+	const s_config *config;
+	bool up;
+	struct ap_phase phases[3];
+	int nphases;
+};
+
+static double elapsed_ms(const struct timespec *start)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start->tv_sec) * 1000.0 + (now.tv_nsec - start->tv_nsec) / 1e6;
+}
+
+/**
+ * @brief Run @p fn and record how long it took
+ */
+static int run_phase(struct ap_job *job, const char *name, int (*fn)(const struct ap_job *))
+{
+	struct ap_phase *phase = &job->phases[job->nphases++];
+	struct timespec start;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	phase->name = name;
+	phase->ret = fn(job);
+	phase->ms = elapsed_ms(&start);
+	return phase->ret;
+}
+
+/* --- sysctl --- */
+
+static int write_proc(const char *path, const char *value)
+{
+	int fd, ret = 0;
+
+	fd = open(path, O_WRONLY | O_CLOEXEC);
+	if (fd < 0) {
+		printf("[-] %s: %s\n", path, strerror(errno));
+		return -1;
+	}
+	if (write(fd, value, strlen(value)) < 0) {
+		printf("[-] %s: %s\n", path, strerror(errno));
+		ret = -1;
+	}
+	close(fd);
+	return ret;
+}
+
+static int phase_sysctl(const struct ap_job *job)
+{
+	int ret = 0;
+
+	/* IPv6 off like StartAP did; missing when IPv6 is not built in */
+	write_proc("/proc/sys/net/ipv6/conf/all/disable_ipv6", "1");
+	write_proc("/proc/sys/net/ipv6/conf/default/disable_ipv6", "1");
+	ret |= write_proc("/proc/sys/net/ipv4/ip_forward", "1");
+
+	return ret;
+}
+
+/* --- nftables --- */
+
+/**
+ * @brief Feed a ruleset to `nft -f -`, which applies it as one transaction
+ */
+static int nft_apply(const char *ruleset)
+{
+	char *argv[] = { "nft", "-f", "-", NULL };
+	posix_spawn_file_actions_t actions;
+	size_t len = strlen(ruleset), done = 0;
+	int pipefd[2], status;
+	pid_t pid;
+
+	if (pipe2(pipefd, O_CLOEXEC) != 0) {
+		return -1;
+	}
+
+	posix_spawn_file_actions_init(&actions);
+	posix_spawn_file_actions_adddup2(&actions, pipefd[0], STDIN_FILENO);
+	if (posix_spawnp(&pid, "nft", &actions, NULL, argv, environ) != 0) {
+		printf("[-] Failed to run nft\n");
+		posix_spawn_file_actions_destroy(&actions);
+		close(pipefd[0]);
+		close(pipefd[1]);
+		return -1;
+	}
+	posix_spawn_file_actions_destroy(&actions);
+	close(pipefd[0]);
+
+	while (done < len) {
+		ssize_t n = write(pipefd[1], ruleset + done, len - done);
+		if (n < 0 && errno == EINTR) {
+			continue;
+		}
+		if (n <= 0) {
+			break;
+		}
+		done += n;
+	}
+	close(pipefd[1]);
+
+	if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+		return -1;
+	}
+	return done == len ? 0 : -1;
+}
+
+static int phase_firewall(const struct ap_job *job)
+{
+	const s_config *config = job->config;
+	char ruleset[2048];
+
+	if (!job->up) {
+		return nft_apply("delete table ip " AP_NFT_TABLE "\n");
+	}
+
+	/* Creating and deleting the table first makes the load idempotent */
+	snprintf(ruleset, sizeof(ruleset),
+		"table ip " AP_NFT_TABLE "\n"
+		"delete table ip " AP_NFT_TABLE "\n"
+		"table ip " AP_NFT_TABLE " {\n"
+		"	chain input {\n"
+		"		type filter hook input priority 0; policy drop;\n"
+		"		iifname \"lo\" accept\n"
+		"		ct state established,related accept\n"
+		"		iifname \"%1$s\" tcp dport { 22, 445 } accept\n"
+		"		iifname \"%2$s\" udp sport 67-68 udp dport 67-68 accept\n"
+		"		iifname \"%2$s\" udp dport 53 accept\n"
+		"		iifname \"%2$s\" tcp dport 53 accept\n"
+		"		iifname \"%2$s\" tcp dport %3$d accept\n"
+		"	}\n"
+		"	chain prerouting {\n"
+		"		type nat hook prerouting priority -100;\n"
+		"		iifname \"%2$s\" tcp dport 80 dnat to %4$s:%3$d\n"
+		"	}\n"
+		"	chain postrouting {\n"
+		"		type nat hook postrouting priority 100;\n"
+		"		oifname \"%1$s\" masquerade\n"
+		"	}\n"
+		"}\n",
+		config->ext_interface, config->gw_interface, config->gw_port, config->gw_address);
+
+	return nft_apply(ruleset);
+}
+
+/* --- rtnetlink --- */
+
+struct nl_request {
+	struct nlmsghdr hdr;
+	union {
+		struct ifinfomsg ifi;
+		struct ifaddrmsg ifa;
+	} msg;
+	char attrs[64];
+};
+
+static void nl_add_attr(struct nlmsghdr *hdr, unsigned short type, const void *data, size_t len)
+{
+	struct rtattr *rta = (struct rtattr *)((char *)hdr + NLMSG_ALIGN(hdr->nlmsg_len));
+
+	rta->rta_type = type;
+	rta->rta_len = RTA_LENGTH(len);
+	memcpy(RTA_DATA(rta), data, len);
+	hdr->nlmsg_len = NLMSG_ALIGN(hdr->nlmsg_len) + RTA_ALIGN(rta->rta_len);
+}
+
+/**
+ * @brief Send a request and wait for its acknowledgement
+ */
+static int nl_transact(int fd, struct nlmsghdr *hdr)
+{
+	static unsigned int seq;
+	char buf[NL_BUFSIZE];
+	ssize_t len;
+
+	hdr->nlmsg_flags |= NLM_F_REQUEST | NLM_F_ACK;
+	hdr->nlmsg_seq = ++seq;
+
+	if (send(fd, hdr, hdr->nlmsg_len, 0) < 0) {
+		return -errno;
+	}
+
+	while ((len = recv(fd, buf, sizeof(buf), 0)) > 0) {
+		struct nlmsghdr *msg;
+
+		for (msg = (struct nlmsghdr *)buf; NLMSG_OK(msg, len); msg = NLMSG_NEXT(msg, len)) {
+			if (msg->nlmsg_seq == hdr->nlmsg_seq && msg->nlmsg_type == NLMSG_ERROR) {
+				return ((struct nlmsgerr *)NLMSG_DATA(msg))->error;
+			}
+		}
+	}
+	return -EIO;
+}
+
+static int link_set_up(int fd, int ifindex, bool up)
+{
+	struct nl_request req;
+
+	memset(&req, 0, sizeof(req));
+	req.hdr.nlmsg_len = NLMSG_LENGTH(sizeof(struct ifinfomsg));
+	req.hdr.nlmsg_type = RTM_NEWLINK;
+	req.msg.ifi.ifi_family = AF_UNSPEC;
+	req.msg.ifi.ifi_index = ifindex;
+	req.msg.ifi.ifi_flags = up ? IFF_UP : 0;
+	req.msg.ifi.ifi_change = IFF_UP;
+
+	return nl_transact(fd, &req.hdr);
+}
+
+/**
+ * @brief Remove all IPv4 addresses from an interface (ip addr flush)
+ */
+static int addr_flush(int fd, int ifindex)
+{
+	struct { unsigned char prefixlen; struct in_addr local; } addrs[MAX_FLUSH_ADDRS];
+	struct nl_request req;
+	char buf[NL_BUFSIZE];
+	int naddrs = 0, i, err, ret = 0;
+	bool done = false;
+	ssize_t len;
+
+	memset(&req, 0, sizeof(req));
+	req.hdr.nlmsg_len = NLMSG_LENGTH(sizeof(struct ifaddrmsg));
+	req.hdr.nlmsg_type = RTM_GETADDR;
+	req.hdr.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+	req.msg.ifa.ifa_family = AF_INET;
+
+	if (send(fd, &req, req.hdr.nlmsg_len, 0) < 0) {
+		return -errno;
+	}
+
+	/* Collect first, the socket is busy until the dump is done */
+	while (!done && (len = recv(fd, buf, sizeof(buf), 0)) > 0) {
+		struct nlmsghdr *msg;
+
+		for (msg = (struct nlmsghdr *)buf; NLMSG_OK(msg, len); msg = NLMSG_NEXT(msg, len)) {
+			struct ifaddrmsg *ifa = NLMSG_DATA(msg);
+			struct rtattr *rta;
+			int rta_len;
+
+			if (msg->nlmsg_type == NLMSG_ERROR) {
+				struct nlmsgerr *nlerr = NLMSG_DATA(msg);
+				return nlerr->error ? nlerr->error : -EIO;
+			}
+			if (msg->nlmsg_type == NLMSG_DONE) {
+				done = true;
+				break;
+			}
+			if (msg->nlmsg_type != RTM_NEWADDR || (int)ifa->ifa_index != ifindex ||
+			    naddrs >= MAX_FLUSH_ADDRS) {
+				continue;
+			}
+
+			rta_len = IFA_PAYLOAD(msg);
+			for (rta = IFA_RTA(ifa); RTA_OK(rta, rta_len); rta = RTA_NEXT(rta, rta_len)) {
+				if (rta->rta_type == IFA_LOCAL) {
+					addrs[naddrs].prefixlen = ifa->ifa_prefixlen;
+					memcpy(&addrs[naddrs].local, RTA_DATA(rta), sizeof(struct in_addr));
+					naddrs++;
+					break;
+				}
+			}
+		}
+	}
+
+	for (i = 0; i < naddrs; i++) {
+		memset(&req, 0, sizeof(req));
+		req.hdr.nlmsg_len = NLMSG_LENGTH(sizeof(struct ifaddrmsg));
+		req.hdr.nlmsg_type = RTM_DELADDR;
+		req.msg.ifa.ifa_family = AF_INET;
+		req.msg.ifa.ifa_prefixlen = addrs[i].prefixlen;
+		req.msg.ifa.ifa_index = ifindex;
+		nl_add_attr(&req.hdr, IFA_LOCAL, &addrs[i].local, sizeof(struct in_addr));
+		err = nl_transact(fd, &req.hdr);
+		if (err < 0) {
+			ret = err;
+		}
+	}
+
+	return ret;
+}
+
+static int addr_add(int fd, int ifindex, struct in_addr addr, int prefixlen)
+{
+	struct nl_request req;
+	struct in_addr brd;
+
+	brd.s_addr = addr.s_addr | htonl(prefixlen >= 32 ? 0 : 0xffffffffU >> prefixlen);
+
+	memset(&req, 0, sizeof(req));
+	req.hdr.nlmsg_len = NLMSG_LENGTH(sizeof(struct ifaddrmsg));
+	req.hdr.nlmsg_type = RTM_NEWADDR;
+	req.hdr.nlmsg_flags = NLM_F_CREATE | NLM_F_REPLACE;
+	req.msg.ifa.ifa_family = AF_INET;
+	req.msg.ifa.ifa_prefixlen = prefixlen;
+	req.msg.ifa.ifa_scope = RT_SCOPE_UNIVERSE;
+	req.msg.ifa.ifa_index = ifindex;
+	nl_add_attr(&req.hdr, IFA_LOCAL, &addr, sizeof(addr));
+	nl_add_attr(&req.hdr, IFA_ADDRESS, &addr, sizeof(addr));
+	nl_add_attr(&req.hdr, IFA_BROADCAST, &brd, sizeof(brd));
+
+	return nl_transact(fd, &req.hdr);
+}
+
+static int phase_addressing(const struct ap_job *job)
+{
+	const s_config *config = job->config;
+	const char *slash = strchr(config->gw_iprange, '/');
+	int prefixlen = slash ? atoi(slash + 1) : 24;
+	struct in_addr addr;
+	int fd, ifindex, ret;
+
+	ifindex = if_nametoindex(config->gw_interface);
+	if (ifindex == 0) {
+		printf("[-] Interface %s not found\n", config->gw_interface);
+		return -1;
+	}
+	if (inet_pton(AF_INET, config->gw_address, &addr) != 1) {
+		printf("[-] Invalid gateway address %s\n", config->gw_address);
+		return -1;
+	}
+
+	fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE);
+	if (fd < 0) {
+		return -1;
+	}
+
+	if (job->up) {
+		/* ip link set up; ip addr flush; ip addr add */
+		ret = link_set_up(fd, ifindex, true);
+		if (ret == 0) {
+			ret = addr_flush(fd, ifindex);
+		}
+		if (ret == 0) {
+			ret = addr_add(fd, ifindex, addr, prefixlen);
+		}
+	} else {
+		ret = link_set_up(fd, ifindex, false);
+	}
+
+	if (ret != 0) {
+		printf("[-] Configuring %s failed: %s\n", config->gw_interface,
+		       ret < 0 ? strerror(-ret) : "error");
+	}
+
+	close(fd);
+	return ret;
+}
+
+/* --- orchestration --- */
+
+static void *firewall_thread(void *arg)
+{
+	struct ap_job *job = arg;
+
+	if (job->up) {
+		run_phase(job, "sysctl", phase_sysctl);
+	}
+	run_phase(job, "nftables", phase_firewall);
+	return NULL;
+}
+
+/**
+ * @brief Run addressing and firewall setup side by side, then report
+ */
+static int ap_run(const s_config *config, bool up)
+{
+	struct ap_job net = { .config = config, .up = up };
+	struct ap_job fw = { .config = config, .up = up };
+	struct timespec start;
+	pthread_t thread;
+	bool threaded;
+	int i, ret = 0;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	threaded = pthread_create(&thread, NULL, firewall_thread, &fw) == 0;
+	run_phase(&net, "rtnetlink", phase_addressing);
+	if (threaded) {
+		pthread_join(thread, NULL);
+	} else {
+		firewall_thread(&fw);
+	}
+
+	for (i = 0; i < fw.nphases; i++) {
+		printf("[%c] %-10s %7.2f ms\n", fw.phases[i].ret ? '-' : '+',
+		       fw.phases[i].name, fw.phases[i].ms);
+		ret |= fw.phases[i].ret;
+	}
+	printf("[%c] %-10s %7.2f ms\n", net.phases[0].ret ? '-' : '+',
+	       net.phases[0].name, net.phases[0].ms);
+	ret |= net.phases[0].ret;
+
+	/* Don't leave a half bring-up behind: the input chain drops by default */
+	if (up && ret && fw.phases[fw.nphases - 1].ret == 0) {
+		printf("[*] Bring-up failed, removing table %s\n", AP_NFT_TABLE);
+		nft_apply("delete table ip " AP_NFT_TABLE "\n");
+	}
+	printf("[%c] %-10s %7.2f ms\n", ret ? '-' : '+', up ? "bring-up" : "tear-down",
+	       elapsed_ms(&start));
+
+	return ret ? -1 : 0;
+}
+
+int ap_bring_up(const s_config *config)
+{
+	return ap_run(config, true);
+}
+
+int ap_tear_down(const s_config *config)
+{
+	return ap_run(config, false);
+}
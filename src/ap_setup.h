@@ -0,0 +1,29 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+// Copyright (C) 2025 R. Moeijes
+
+/** @file ap_setup.h
+ * @brief Native access point bring-up and tear-down
+ * @author R. Moeijes
+ * @date 2025
+ * @copyright GPL v2+
+ */
+
+#ifndef _AP_SETUP_H_
+#define _AP_SETUP_H_
+
+#include "main.h"
+
+#define AP_NFT_TABLE "simple_wifi"
+
+/** @brief Configure addressing, sysctls and the firewall for the portal.
+ *
+ * The interface address goes over rtnetlink and the whole ruleset is
+ * installed as one nftables transaction; both run concurrently.
+ * Returns 0 on success.
+ */
+int ap_bring_up(const s_config *config);
+
+/** @brief Remove the portal firewall table and take the interface down. */
+int ap_tear_down(const s_config *config);
+
+#endif /* _AP_SETUP_H_ */
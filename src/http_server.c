@@ -22,14 +22,23 @@
 #include <unistd.h>
 #include <sys/stat.h>
 #include <stdbool.h>
+#include <signal.h>
+#include <dirent.h>
+#include <ctype.h>
+#include <time.h>
 
 // #include "common.h" // No longer needed
 #include "http_server.h"
 #include "main.h"
+#include "template.h"
+#include "trace.h"
+#include "psk.h"
+#include "record.h"
 // #include "mimetypes.h" // No longer needed
 // #include "util.h" // No longer needed
 
 #define QUERYMAXLEN 4096
+#define WIFI_CONFIG_FILE "/tmp/wifi-config.txt"
 
 /* Mimetypes struct and list */
 struct mimetype {
@@ -136,7 +145,23 @@ typedef struct {
     char *password;
 } connection_info_t;
 
+/* Per-connection state, only allocated while tracing or recording */
+typedef struct {
+	uint64_t accepted;
+	uint64_t req_start;
+	uint64_t queued;
+	uint32_t req;
+	uint32_t conn;
+	unsigned int status;
+	bool accept_traced;	/* accept span ends at the first request */
+	bool wants_close;	/* current request asked for Connection: close */
+	enum record_closer closed_by;	/* who ends the connection, as far as known */
+} trace_conn_t;
+
 /* Forward declarations */
+static enum MHD_Result dispatch_request(struct MHD_Connection *connection, const char *url,
+                                        const char *method, const char *upload_data,
+                                        size_t *upload_data_size, void **ptr);
 static enum MHD_Result handle_request(struct MHD_Connection *connection, const char *url, 
                                      const char *method);
 static enum MHD_Result handle_post_request(struct MHD_Connection *connection, 
@@ -160,6 +185,58 @@ static const char *get_file_extension(const char *filename);
 static const char *get_mime_type(const char *filename);
 static void save_wifi_config(const char *ssid, const char *password);
 
+/* Splash page templates: one compiled template and cached response per locale */
+#define SPLASH_MAX_LOCALES 8
+#define SPLASH_MAX_LANG 9
+
+enum splash_slot {
+	SPLASH_SLOT_GW_NAME,
+	SPLASH_SLOT_SSID,
+	SPLASH_SLOT_GW_ADDRESS,
+	SPLASH_SLOT_GW_PORT,
+	SPLASH_SLOT_LANG,
+	SPLASH_SLOT_VERSION,
+	SPLASH_SLOT_NETWORKS,
+	SPLASH_SLOT_COUNT
+};
+
+static const struct tpl_slot splash_slots[SPLASH_SLOT_COUNT] = {
+	[SPLASH_SLOT_GW_NAME]    = { "gw_name", TPL_ESCAPE_HTML },
+	[SPLASH_SLOT_SSID]       = { "ssid", TPL_ESCAPE_HTML },
+	[SPLASH_SLOT_GW_ADDRESS] = { "gw_address", TPL_ESCAPE_HTML },
+	[SPLASH_SLOT_GW_PORT]    = { "gw_port", TPL_ESCAPE_HTML },
+	[SPLASH_SLOT_LANG]       = { "lang", TPL_ESCAPE_HTML },
+	[SPLASH_SLOT_VERSION]    = { "version", TPL_ESCAPE_HTML },
+	[SPLASH_SLOT_NETWORKS]   = { "networks", TPL_ESCAPE_SCRIPT },
+};
+
+typedef struct {
+	char lang[SPLASH_MAX_LANG];
+	tpl_t tpl;
+	struct MHD_Response *response;
+} splash_locale_t;
+
+/* Only touched from the libmicrohttpd polling thread, so no locking.
+ * Entry 0 is always the default splash page. */
+static splash_locale_t splash_locales[SPLASH_MAX_LOCALES];
+static const char *splash_tags[SPLASH_MAX_LOCALES];
+static int splash_nlocales;
+
+/* Bumped by http_server_reload(), compared on each splash request */
+static volatile sig_atomic_t splash_generation = 1;
+static sig_atomic_t splash_loaded_generation;
+
+/* Scan results written by StartAP, inlined into the splash page */
+#define SCAN_RESULTS_FILE "wifi-networks.json"
+#define SCAN_RESULTS_MAX (64 * 1024)
+#define SCAN_CHECK_INTERVAL 1 /* seconds between stat() calls */
+
+static struct stat scan_stat;
+static time_t scan_checked;
+
+static void splash_load(void);
+static void splash_render(void);
+
 /* URL encoding function 
 static int url_encode(char *dest, size_t dest_size, const char *src, size_t src_len)
 {
@@ -189,6 +266,152 @@ static int url_encode(char *dest, size_t dest_size, const char *src, size_t src_
 	return 0;
 }
 */
+/**
+ * @brief Get the trace state of a connection, NULL when not tracing or recording
+ */
+static trace_conn_t *trace_get_conn(struct MHD_Connection *connection)
+{
+	const union MHD_ConnectionInfo *info;
+
+	if (!trace_enabled && !record_enabled) {
+		return NULL;
+	}
+	info = MHD_get_connection_info(connection, MHD_CONNECTION_INFO_SOCKET_CONTEXT);
+	return info ? info->socket_context : NULL;
+}
+
+/**
+ * @brief Connection open/close notification, used for tracing and recording
+ */
+void http_server_notify_connection(void *cls, struct MHD_Connection *connection,
+                                   void **socket_context,
+                                   enum MHD_ConnectionNotificationCode toe)
+{
+	static uint32_t last_conn;
+	trace_conn_t *tc = *socket_context;
+
+	if (toe == MHD_CONNECTION_NOTIFY_STARTED) {
+		TRACE_PROBE1(connection_accept, connection);
+		if (!trace_enabled && !record_enabled) {
+			return;
+		}
+		tc = calloc(1, sizeof(*tc));
+		if (tc) {
+			tc->accepted = trace_now();
+			tc->conn = ++last_conn;
+			if (record_enabled) {
+				record_connection_open(tc->conn, tc->accepted);
+			}
+		}
+		*socket_context = tc;
+		return;
+	}
+
+	TRACE_PROBE1(connection_close, connection);
+	if (tc) {
+		if (trace_enabled) {
+			trace_set_request(0);
+			trace_span(TRACE_CONNECTION, tc->accepted, NULL);
+		}
+		if (record_enabled) {
+			record_connection_close(tc->conn, tc->closed_by, trace_now());
+		}
+		free(tc);
+		*socket_context = NULL;
+	}
+}
+
+/**
+ * @brief Request completion notification, closes the request span
+ */
+void http_server_request_completed(void *cls, struct MHD_Connection *connection,
+                                   void **con_cls, enum MHD_RequestTerminationCode toe)
+{
+	trace_conn_t *tc;
+
+	TRACE_PROBE2(request_complete, connection, (int)toe);
+
+	tc = trace_get_conn(connection);
+	if (!tc || !tc->req) {
+		return;
+	}
+
+	if (record_enabled) {
+		uint64_t now = trace_now();
+		record_done(tc->conn, tc->status, now - tc->req_start, now);
+	}
+
+	/* A close right after this request is ours when the request asked for
+	 * it or failed on our side; an idle keep-alive is closed by the phone. */
+	switch (toe) {
+	case MHD_REQUEST_TERMINATED_COMPLETED_OK:
+		tc->closed_by = tc->wants_close ? RECORD_CLOSED_BY_SERVER : RECORD_CLOSED_BY_CLIENT;
+		break;
+	case MHD_REQUEST_TERMINATED_WITH_ERROR:
+	case MHD_REQUEST_TERMINATED_TIMEOUT_REACHED:
+	case MHD_REQUEST_TERMINATED_DAEMON_SHUTDOWN:
+		tc->closed_by = RECORD_CLOSED_BY_SERVER;
+		break;
+	default:
+		tc->closed_by = RECORD_CLOSED_BY_CLIENT;
+		break;
+	}
+	if (trace_enabled) {
+		trace_set_request(tc->req);
+		if (tc->queued) {
+			trace_span(TRACE_COMPLETE, tc->queued, toe == MHD_REQUEST_TERMINATED_COMPLETED_OK ?
+			           "ok" : "aborted");
+		}
+		trace_span(TRACE_REQUEST, tc->req_start, NULL);
+	}
+	tc->req = 0;
+	tc->queued = 0;
+	tc->status = 0;
+}
+
+/**
+ * @brief Queue a response, tracing how long libmicrohttpd takes to accept it
+ */
+static enum MHD_Result queue_response(struct MHD_Connection *connection,
+                                      unsigned int status, struct MHD_Response *response)
+{
+	enum MHD_Result ret;
+	trace_conn_t *tc;
+	TRACE_BEGIN(t_queue);
+
+	TRACE_PROBE2(response_queue, connection, status);
+	ret = MHD_queue_response(connection, status, response);
+
+	tc = trace_get_conn(connection);
+	if (tc) {
+		tc->queued = trace_now();
+		tc->status = status;
+	}
+	if (trace_enabled) {
+		char detail[8];
+
+		snprintf(detail, sizeof(detail), "%u", status);
+		trace_span(TRACE_QUEUE, t_queue, detail);
+	}
+
+	return ret;
+}
+
+/**
+ * @brief Check whether libmicrohttpd will close the connection after this request
+ */
+static bool request_wants_close(struct MHD_Connection *connection, const char *version)
+{
+	const char *value = MHD_lookup_connection_value(connection, MHD_HEADER_KIND,
+	                                                MHD_HTTP_HEADER_CONNECTION);
+
+	if (value && strcasestr(value, "close")) {
+		return true;
+	}
+	return strcmp(version, MHD_HTTP_VERSION_1_0) == 0 &&
+	       !(value && strcasestr(value, "keep-alive"));
+}
+
 /**
  * @brief Main HTTP request callback for libmicrohttpd
  */
@@ -197,11 +420,48 @@ enum MHD_Result libmicrohttpd_cb(void *cls, struct MHD_Connection *connection,
                                 const char *upload_data, size_t *upload_data_size, void **ptr)
 {
 	char url[PATH_MAX] = {0};
+	trace_conn_t *tc = trace_get_conn(connection);
+	enum MHD_Result ret;
+
+	/* POST bodies arrive in several calls, the request starts at the first */
+	if (tc && !tc->req) {
+		tc->req = trace_new_request();
+		tc->req_start = trace_now();
+		tc->wants_close = request_wants_close(connection, version);
+		if (record_enabled) {
+			record_request(tc->conn, connection, method, _url, tc->req_start);
+		}
+	}
+	if (trace_enabled) {
+		trace_set_request(tc ? tc->req : 0);
+		/* Accept-to-first-request: idle preconnects show up here */
+		if (tc && !tc->accept_traced) {
+			trace_span(TRACE_ACCEPT, tc->accepted, NULL);
+			tc->accept_traced = true;
+		}
+	}
+	TRACE_PROBE2(request_start, connection, _url);
 
 	/* Sanitize URL path */
+	TRACE_BEGIN(t_sanitize);
 	buffer_path_simplify(url, _url);
+	TRACE_END(TRACE_SANITIZE, t_sanitize, url);
 	printf("Request: %s %s\n", method, url);
 
+	TRACE_BEGIN(t_dispatch);
+	ret = dispatch_request(connection, url, method, upload_data, upload_data_size, ptr);
+	TRACE_END(TRACE_DISPATCH, t_dispatch, method);
+
+	return ret;
+}
+
+/**
+ * @brief Route a sanitized request to its handler
+ */
+static enum MHD_Result dispatch_request(struct MHD_Connection *connection, const char *url,
+                                        const char *method, const char *upload_data,
+                                        size_t *upload_data_size, void **ptr)
+{
 	/* Handle POST requests */
 	if (strcmp(method, "POST") == 0) {
 		/* Only allow POST to /save endpoint */
@@ -245,7 +505,7 @@ static enum MHD_Result handle_request(struct MHD_Connection *connection, const c
 		const char *redirect_html = "<html><head></head><body><a href='http://192.168.4.1:2050/splash.html?redir=http%3A%2F%2Fconnectivitycheck.gstatic.com%2Fgenerate_204'>Click here to continue</a></body></html>";
 	   struct MHD_Response *response = MHD_create_response_from_buffer(strlen(redirect_html), (void *)redirect_html, MHD_RESPMEM_PERSISTENT);
 	   MHD_add_response_header(response, "Location", location);
-	   return MHD_queue_response(connection, MHD_HTTP_TEMPORARY_REDIRECT, response);
+	   return queue_response(connection, MHD_HTTP_TEMPORARY_REDIRECT, response);
 	}
 
 	/* For all other requests (e.g. /, or any other captive portal check), serve the main splash page directly with a 200 OK. */
@@ -307,7 +567,7 @@ static enum MHD_Result send_error_page(struct MHD_Connection *connection, int er
 	                                          (void *)error_page, MHD_RESPMEM_PERSISTENT);
 	if (response) {
 		MHD_add_response_header(response, "Content-Type", mime_type);
-		ret = MHD_queue_response(connection, http_status, response);
+		ret = queue_response(connection, http_status, response);
 		MHD_destroy_response(response);
 	}
 
@@ -315,70 +575,426 @@ static enum MHD_Result send_error_page(struct MHD_Connection *connection, int er
 }
 
 /**
- * @brief Serve splash page with template variables
+ * @brief Derive the access point SSID the same way StartAP does
  */
-static enum MHD_Result serve_splash_page(struct MHD_Connection *connection)
+static void get_ap_ssid(char *ssid, size_t size)
 {
-	s_config *config = config_get_config();
-	struct MHD_Response *response;
-	char filename[PATH_MAX];
-	const char *mime_type;
-	char *file_content = NULL;
-	struct stat stat_buf;
-	int fd, bytes_read = 0, file_size;
-	enum MHD_Result ret;
+	char *p;
 
-	/* Build filename */
-	snprintf(filename, PATH_MAX, "%s/%s", config->webroot, config->splashpage);
+	if (gethostname(ssid, size) != 0) {
+		snprintf(ssid, size, "simple-wifi");
+	}
+	ssid[size - 1] = '\0';
 
-	/* Check if file exists */
-	if (stat(filename, &stat_buf) != 0 || !S_ISREG(stat_buf.st_mode)) {
-		return send_error_page(connection, 404);
+	for (p = ssid; *p; p++) {
+		*p = toupper((unsigned char)*p);
 	}
+}
 
-	/* Open file */
+/**
+ * @brief Compile one splash template and add it as a locale
+ */
+static void splash_add_locale(const char *filename, const char *lang)
+{
+	splash_locale_t *locale;
+
+	if (splash_nlocales >= SPLASH_MAX_LOCALES || strlen(lang) >= SPLASH_MAX_LANG) {
+		printf("Warning: Ignoring splash template %s\n", filename);
+		return;
+	}
+
+	locale = &splash_locales[splash_nlocales];
+	if (tpl_compile(&locale->tpl, filename, splash_slots, SPLASH_SLOT_COUNT) != 0) {
+		printf("Error: Failed to load splash template %s\n", filename);
+		return;
+	}
+
+	strcpy(locale->lang, lang);
+	locale->response = NULL;
+	splash_tags[splash_nlocales] = locale->lang;
+	splash_nlocales++;
+}
+
+static const char *skip_space(const char *p)
+{
+	while (*p == ' ' || *p == '\n' || *p == '\t' || *p == '\r') {
+		p++;
+	}
+	return p;
+}
+
+/**
+ * @brief Rewrite the scan results as a well-formed JSON array of strings
+ *
+ * The SSIDs come from nearby access points and StartAP only escapes '"',
+ * so the file can be anything. Valid escapes are copied, control bytes
+ * are escaped, and anything that is not an array of strings gives NULL.
+ * Returns a malloc'd string.
+ */
+static char *sanitize_scan_results(const char *json)
+{
+	const char *p = skip_space(json);
+	char *out, *o;
+	int i;
+
+	if (*p++ != '[') {
+		return NULL;
+	}
+	/* Worst case every byte becomes \u00XX */
+	out = malloc(strlen(p) * 6 + 3);
+	if (!out) {
+		return NULL;
+	}
+	o = out;
+	*o++ = '[';
+
+	p = skip_space(p);
+	if (*p == ']') {
+		p++;
+	} else {
+		for (;;) {
+			if (*p++ != '"') {
+				goto fail;
+			}
+			*o++ = '"';
+			while (*p != '"') {
+				unsigned char c = *p;
+
+				if (c == '\0') {
+					goto fail;
+				} else if (c == '\\') {
+					if (p[1] == 'u') {
+						for (i = 2; i < 6; i++) {
+							if (!isxdigit((unsigned char)p[i])) {
+								goto fail;
+							}
+						}
+						memcpy(o, p, 6);
+						o += 6;
+						p += 6;
+						continue;
+					}
+					if (!p[1] || !strchr("\"\\/bfnrt", p[1])) {
+						goto fail;
+					}
+					*o++ = *p++;
+					*o++ = *p++;
+				} else if (c < 0x20) {
+					o += sprintf(o, "\\u%04x", c);
+					p++;
+				} else {
+					*o++ = *p++;
+				}
+			}
+			*o++ = '"';
+			p = skip_space(p + 1);
+			if (*p == ']') {
+				p++;
+				break;
+			}
+			if (*p++ != ',') {
+				goto fail;
+			}
+			*o++ = ',';
+			p = skip_space(p);
+		}
+	}
+	if (*skip_space(p) != '\0') {
+		goto fail;
+	}
+
+	*o++ = ']';
+	*o = '\0';
+	return out;
+
+fail:
+	free(out);
+	return NULL;
+}
+
+/**
+ * @brief Read the scan results as a JSON array, remembering the file state
+ *
+ * Returns a malloc'd string, or NULL when there is no usable scan yet.
+ */
+static char *read_scan_results(void)
+{
+	s_config *config = config_get_config();
+	char filename[PATH_MAX];
+	char *content, *networks;
+	ssize_t bytes_read;
+	int fd;
+
+	memset(&scan_stat, 0, sizeof(scan_stat));
+
+	snprintf(filename, PATH_MAX, "%s/%s", config->webroot, SCAN_RESULTS_FILE);
 	fd = open(filename, O_RDONLY);
 	if (fd < 0) {
-		return send_error_page(connection, 404);
+		return NULL;
 	}
 
-	/* Get file size */
-	file_size = lseek(fd, 0, SEEK_END);
-	lseek(fd, 0, SEEK_SET);
+	if (fstat(fd, &scan_stat) != 0 || !S_ISREG(scan_stat.st_mode) ||
+	    scan_stat.st_size > SCAN_RESULTS_MAX) {
+		close(fd);
+		return NULL;
+	}
 
-	/* Allocate memory for file content */
-	file_content = calloc(file_size + 1, 1);
-	if (!file_content) {
+	content = calloc(scan_stat.st_size + 1, 1);
+	if (!content) {
 		close(fd);
-		return send_error_page(connection, 503);
+		return NULL;
+	}
+
+	bytes_read = read(fd, content, scan_stat.st_size);
+	close(fd);
+
+	/* StartAP writes ["ssid",...]; anything else falls back to the fetch */
+	networks = NULL;
+	if (bytes_read == scan_stat.st_size) {
+		networks = sanitize_scan_results(content);
+	}
+	free(content);
+
+	if (!networks) {
+		printf("Warning: %s is not a list of networks, not inlining it\n", SCAN_RESULTS_FILE);
+	}
+	return networks;
+}
+
+/**
+ * @brief Re-render the splash pages when the scan results changed
+ *
+ * Called per request, but only stats the file once per interval.
+ */
+static void splash_check_scan(void)
+{
+	s_config *config = config_get_config();
+	char filename[PATH_MAX];
+	struct timespec now;
+	struct stat stat_buf;
+
+	clock_gettime(CLOCK_MONOTONIC_COARSE, &now);
+	if (now.tv_sec - scan_checked < SCAN_CHECK_INTERVAL) {
+		return;
 	}
+	scan_checked = now.tv_sec;
 
-	/* Read file */
-	while (bytes_read < file_size) {
-		int ret_read = read(fd, file_content + bytes_read, file_size - bytes_read);
-		if (ret_read < 0) {
-			free(file_content);
-			close(fd);
-			return send_error_page(connection, 503);
+	snprintf(filename, PATH_MAX, "%s/%s", config->webroot, SCAN_RESULTS_FILE);
+	if (stat(filename, &stat_buf) != 0) {
+		memset(&stat_buf, 0, sizeof(stat_buf));
+	}
+
+	if (stat_buf.st_ino != scan_stat.st_ino || stat_buf.st_size != scan_stat.st_size ||
+	    stat_buf.st_mtim.tv_sec != scan_stat.st_mtim.tv_sec ||
+	    stat_buf.st_mtim.tv_nsec != scan_stat.st_mtim.tv_nsec) {
+		printf("Info: Scan results changed, re-rendering splash page\n");
+		splash_render();
+	}
+}
+
+/**
+ * @brief Render every locale into a reusable response
+ */
+static void splash_render(void)
+{
+	s_config *config = config_get_config();
+	const char *values[SPLASH_SLOT_COUNT];
+	char ssid[64], port[8];
+	char *networks;
+	int i;
+
+	get_ap_ssid(ssid, sizeof(ssid));
+	snprintf(port, sizeof(port), "%d", config->gw_port);
+
+	values[SPLASH_SLOT_GW_NAME] = config->gw_name;
+	values[SPLASH_SLOT_SSID] = ssid;
+	values[SPLASH_SLOT_GW_ADDRESS] = config->gw_address;
+	values[SPLASH_SLOT_GW_PORT] = port;
+	values[SPLASH_SLOT_VERSION] = WIFI_CONFIG_AP_VERSION;
+
+	networks = read_scan_results();
+	values[SPLASH_SLOT_NETWORKS] = networks ? networks : "null";
+
+	for (i = 0; i < splash_nlocales; i++) {
+		splash_locale_t *locale = &splash_locales[i];
+		struct MHD_Response *response;
+		size_t len;
+		char *page;
+
+		values[SPLASH_SLOT_LANG] = locale->lang;
+		page = tpl_render(&locale->tpl, values, &len);
+		if (!page) {
+			continue;
 		}
-		bytes_read += ret_read;
+
+		response = MHD_create_response_from_buffer(len, page, MHD_RESPMEM_MUST_FREE);
+		if (!response) {
+			free(page);
+			continue;
+		}
+		MHD_add_response_header(response, "Content-Type", get_mime_type(config->splashpage));
+		MHD_add_response_header(response, "Content-Language", locale->lang);
+		MHD_add_response_header(response, "Vary", "Accept-Language");
+
+		/* Requests still sending the old page hold their own reference */
+		if (locale->response) {
+			MHD_destroy_response(locale->response);
+		}
+		locale->response = response;
 	}
-	close(fd);
 
-	/* Create response directly from file content */
-	mime_type = get_mime_type(filename);
-	response = MHD_create_response_from_buffer(file_size, 
-	                                          file_content, MHD_RESPMEM_MUST_FREE);
-	if (!response) {
-		free(file_content);
-		return send_error_page(connection, 503);
+	free(networks);
+}
+
+/**
+ * @brief (Re)load all splash templates from the webroot and render them
+ *
+ * Besides the default page (e.g. splash.html) every translation named
+ * like splash.nl.html is picked up, keyed by its language tag.
+ */
+static void splash_load(void)
+{
+	s_config *config = config_get_config();
+	char filename[PATH_MAX];
+	const char *ext;
+	size_t base_len;
+	struct dirent *entry;
+	DIR *dir;
+	int i;
+
+	splash_loaded_generation = splash_generation;
+
+	for (i = 0; i < splash_nlocales; i++) {
+		if (splash_locales[i].response) {
+			MHD_destroy_response(splash_locales[i].response);
+		}
+		tpl_free(&splash_locales[i].tpl);
 	}
+	splash_nlocales = 0;
 
-	MHD_add_response_header(response, "Content-Type", mime_type);
-	ret = MHD_queue_response(connection, MHD_HTTP_OK, response);
-	MHD_destroy_response(response);
+	snprintf(filename, PATH_MAX, "%s/%s", config->webroot, config->splashpage);
+	splash_add_locale(filename, config->splash_lang);
+	if (splash_nlocales == 0) {
+		return;
+	}
 
-	return ret;
+	/* Translations: <base>.<lang>.<ext> next to the default page */
+	ext = strrchr(config->splashpage, '.');
+	base_len = ext ? (size_t)(ext - config->splashpage) : strlen(config->splashpage);
+	ext = ext ? ext : "";
+
+	dir = opendir(config->webroot);
+	while (dir && (entry = readdir(dir)) != NULL) {
+		const char *lang = entry->d_name + base_len + 1;
+		size_t name_len = strlen(entry->d_name);
+		char tag[SPLASH_MAX_LANG];
+		size_t lang_len;
+
+		if (name_len <= base_len + 1 + strlen(ext) ||
+		    strncmp(entry->d_name, config->splashpage, base_len) != 0 ||
+		    entry->d_name[base_len] != '.' ||
+		    strcmp(entry->d_name + name_len - strlen(ext), ext) != 0) {
+			continue;
+		}
+
+		lang_len = name_len - base_len - 1 - strlen(ext);
+		if (lang_len == 0 || lang_len >= SPLASH_MAX_LANG ||
+		    memchr(lang, '.', lang_len) != NULL) {
+			continue;
+		}
+
+		snprintf(filename, PATH_MAX, "%s/%s", config->webroot, entry->d_name);
+		snprintf(tag, sizeof(tag), "%.*s", (int)lang_len, lang);
+		splash_add_locale(filename, tag);
+	}
+	if (dir) {
+		closedir(dir);
+	}
+
+	splash_render();
+
+	printf("Info: Splash page loaded, %d locale(s):", splash_nlocales);
+	for (i = 0; i < splash_nlocales; i++) {
+		printf(" %s", splash_tags[i]);
+	}
+	printf("\n");
+}
+
+/**
+ * @brief Load the splash templates before the server starts
+ */
+int http_server_init(void)
+{
+	splash_load();
+	return splash_nlocales > 0 ? 0 : -1;
+}
+
+/**
+ * @brief Request a template reload; safe to call from a signal handler
+ */
+void http_server_reload(void)
+{
+	splash_generation++;
+}
+
+/**
+ * @brief End a file/cache span with the status, so errors show up too
+ */
+static void trace_end_status(enum trace_event event, uint64_t start, int status, const char *what)
+{
+	char detail[64];
+
+	if (trace_enabled) {
+		snprintf(detail, sizeof(detail), "%d %s", status, what);
+		trace_span(event, start, detail);
+	}
+}
+
+/**
+ * @brief Send an error page, closing the span that was running
+ */
+static enum MHD_Result traced_error_page(struct MHD_Connection *connection, int error_code,
+                                         enum trace_event event, uint64_t start, const char *what)
+{
+	trace_end_status(event, start, error_code, what);
+	return send_error_page(connection, error_code);
+}
+
+/**
+ * @brief Serve splash page with template variables
+ *
+ * The page was rendered when the templates or the scan results last
+ * changed; a request only picks the cached response for the client's
+ * preferred language.
+ */
+static enum MHD_Result serve_splash_page(struct MHD_Connection *connection)
+{
+	const char *accept_language;
+	int locale;
+	TRACE_BEGIN(t_cache);
+
+	if (splash_loaded_generation != splash_generation) {
+		splash_load();
+	}
+	splash_check_scan();
+
+	if (splash_nlocales == 0) {
+		return traced_error_page(connection, 404, TRACE_CACHE, t_cache, "no splash page");
+	}
+
+	accept_language = MHD_lookup_connection_value(connection, MHD_HEADER_KIND,
+	                                              MHD_HTTP_HEADER_ACCEPT_LANGUAGE);
+	locale = tpl_match_locale(accept_language, splash_tags, splash_nlocales);
+	if (locale < 0 || !splash_locales[locale].response) {
+		locale = 0;
+	}
+	if (!splash_locales[locale].response) {
+		return traced_error_page(connection, 503, TRACE_CACHE, t_cache, splash_locales[locale].lang);
+	}
+	trace_end_status(TRACE_CACHE, t_cache, MHD_HTTP_OK, splash_locales[locale].lang);
+
+	/* The cached response is reference counted, so it is queued as-is */
+	return queue_response(connection, MHD_HTTP_OK, splash_locales[locale].response);
 }
 
 /**
@@ -394,47 +1010,50 @@ static enum MHD_Result serve_static_file(struct MHD_Connection *connection, cons
 	int fd;
 	off_t file_size;
 	enum MHD_Result ret;
+	TRACE_BEGIN(t_file);
 
 	/* Build full file path */
 	snprintf(filename, PATH_MAX, "%s/%s", config->webroot, url);
+	TRACE_PROBE2(file_open, connection, filename);
 
 	/* Check if file exists and is regular file */
 	if (stat(filename, &stat_buf) != 0) {
-		return send_error_page(connection, 404);
+		return traced_error_page(connection, 404, TRACE_FILE, t_file, url);
 	}
 
 	if (!S_ISREG(stat_buf.st_mode)) {
 #ifdef S_ISLNK
 		if (!S_ISLNK(stat_buf.st_mode))
 #endif
-		return send_error_page(connection, 404);
+		return traced_error_page(connection, 404, TRACE_FILE, t_file, url);
 	}
 
 	/* Open file */
 	fd = open(filename, O_RDONLY);
 	if (fd < 0) {
-		return send_error_page(connection, 404);
+		return traced_error_page(connection, 404, TRACE_FILE, t_file, url);
 	}
 
 	/* Get file size */
 	file_size = lseek(fd, 0, SEEK_END);
 	if (file_size < 0) {
 		close(fd);
-		return send_error_page(connection, 404);
+		return traced_error_page(connection, 404, TRACE_FILE, t_file, url);
 	}
 
 	/* Create response from file descriptor */
 	response = MHD_create_response_from_fd(file_size, fd);
 	if (!response) {
 		close(fd);
-		return send_error_page(connection, 503);
+		return traced_error_page(connection, 503, TRACE_FILE, t_file, url);
 	}
 
 	/* Set content type */
 	mime_type = get_mime_type(filename);
 	MHD_add_response_header(response, "Content-Type", mime_type);
+	trace_end_status(TRACE_FILE, t_file, MHD_HTTP_OK, url);
 
-	ret = MHD_queue_response(connection, MHD_HTTP_OK, response);
+	ret = queue_response(connection, MHD_HTTP_OK, response);
 	MHD_destroy_response(response);
 
 	return ret;
@@ -541,7 +1160,7 @@ static enum MHD_Result handle_post_request(struct MHD_Connection *connection,
 	struct MHD_Response *response = MHD_create_response_from_buffer(
 		strlen(success_page), (void *)success_page, MHD_RESPMEM_PERSISTENT);
 	
-	enum MHD_Result ret = MHD_queue_response(connection, MHD_HTTP_OK, response);
+	enum MHD_Result ret = queue_response(connection, MHD_HTTP_OK, response);
 	MHD_destroy_response(response);
 	
 	/* Schedule exit after successful configuration */
@@ -575,16 +1194,35 @@ static enum MHD_Result process_post_data(void *coninfo_cls, enum MHD_ValueKind k
 }
 
 /**
- * @brief Save WiFi configuration to file
+ * @brief Write SSID, passphrase and PSK for StartAP, replacing any earlier file atomically
+ *
+ * The PSK line stays empty until it is derived. It only works for
+ * WPA-PSK networks; StartAP uses the passphrase for anything else (SAE).
  */
-static void save_wifi_config(const char *ssid, const char *password)
+static void write_wifi_config(const char *ssid, const char *password, const char *psk_hex)
 {
-	FILE *file = fopen("/tmp/wifi-config.txt", "w");
+	FILE *file = fopen(WIFI_CONFIG_FILE ".tmp", "w");
 	if (file) {
-		fprintf(file, "%s\n%s\n", ssid, password);
+		fprintf(file, "%s\n%s\n%s\n", ssid, password, psk_hex ? psk_hex : "");
 		fclose(file);
-		printf("Info: WiFi config written to /tmp/wifi-config.txt\n");
-	} else {
-		printf("Error: Failed to write WiFi config file\n");
+		if (rename(WIFI_CONFIG_FILE ".tmp", WIFI_CONFIG_FILE) == 0) {
+			printf("Info: WiFi config written to %s\n", WIFI_CONFIG_FILE);
+			return;
+		}
 	}
+	printf("Error: Failed to write WiFi config file\n");
+}
+
+/**
+ * @brief Save WiFi configuration to file
+ *
+ * The passphrase is written right away; the derived PSK is added as a
+ * third line as soon as it is ready, well within the exit delay.
+ */
+static void save_wifi_config(const char *ssid, const char *password)
+{
+	/* An earlier derivation must not overwrite this configuration */
+	psk_wait();
+	write_wifi_config(ssid, password, NULL);
+	psk_derive_async(ssid, password, write_wifi_config);
 }
@@ -17,6 +17,21 @@ struct MHD_Connection;
 int arp_get(char mac_addr[18], const char req_ip[]);
 
 
+/** @brief Load and render the splash templates. Returns 0 when a page is available. */
+int http_server_init(void);
+
+/** @brief Re-render cached pages on the next request (signal safe). */
+void http_server_reload(void);
+
+/** @brief Connection open/close notification (MHD_OPTION_NOTIFY_CONNECTION). */
+void http_server_notify_connection(void *cls, struct MHD_Connection *connection,
+                                   void **socket_context,
+                                   enum MHD_ConnectionNotificationCode toe);
+
+/** @brief Request completion notification (MHD_OPTION_NOTIFY_COMPLETED). */
+void http_server_request_completed(void *cls, struct MHD_Connection *connection,
+                                   void **con_cls, enum MHD_RequestTerminationCode toe);
+
 enum MHD_Result libmicrohttpd_cb (void *cls,
 					struct MHD_Connection *connection,
 					const char *url,
@@ -19,15 +19,22 @@
 
 #include "main.h"
 #include "http_server.h"
+#include "trace.h"
+#include "psk.h"
+#include "ap_setup.h"
+#include "record.h"
+#include "replay.h"
 
 // Simple hardcoded config
 static s_config config = {
     .configfile = "/etc/simple-wifi/simple-wifi.conf",
     .gw_name = "WiFi Setup Portal",
     .gw_interface = "wlan0", 
+    .ext_interface = "eth0",
     .gw_port = 2050,
     .webroot = "/etc/simple-wifi/htdocs",
     .splashpage = "splash.html",
+    .splash_lang = "en",
     .debuglevel = 0,
     .maxclients = 20,
     .log_syslog = 1,
@@ -41,6 +48,7 @@ static s_config config = {
 };
 
 static struct MHD_Daemon *webserver = NULL;
+static volatile sig_atomic_t trace_dump_requested = 0;
 
 // Clean exit function
 void termination_handler(int sig) {
@@ -50,26 +58,142 @@ void termination_handler(int sig) {
         MHD_stop_daemon(webserver);
     }
     
+    // Make sure a PSK being derived still reaches the config file
+    psk_wait();
+    
     exit(0);
 }
 
+// Reload templates, e.g. after the config or htdocs changed
+static void reload_handler(int sig) {
+    http_server_reload();
+}
+
+// Ask the main loop to write the trace buffers
+static void trace_dump_handler(int sig) {
+    trace_dump_requested = 1;
+}
+
 // Config getter function
 s_config *config_get_config(void) {
     return &config;
 }
 
 int main(int argc, char **argv) {
-    // Handle version/help
-    if (argc > 1) {
-        if (strcmp(argv[1], "-v") == 0 || strcmp(argv[1], "--version") == 0) {
+    enum { RUN_PORTAL, RUN_BRING_UP, RUN_TEAR_DOWN, RUN_REPLAY } action = RUN_PORTAL;
+    const char *record_file = NULL;
+    struct replay_options replay = {
+        .host = "127.0.0.1",
+        .port = 0,
+        .speed = 1.0,
+        .threshold = 20.0
+    };
+
+    // Handle command line options
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-v") == 0 || strcmp(argv[i], "--version") == 0) {
             printf("simple-wifi %s\n", WIFI_CONFIG_AP_VERSION);
             return 0;
         }
-        if (strcmp(argv[1], "-h") == 0 || strcmp(argv[1], "--help") == 0) {
+        if (strcmp(argv[i], "-h") == 0 || strcmp(argv[i], "--help") == 0) {
             printf("simple-wifi %s - WiFi Captive Portal\n", WIFI_CONFIG_AP_VERSION);
-            printf("Usage: %s [-v|--version] [-h|--help]\n", argv[0]);
+            printf("Usage: %s [-v|--version] [-h|--help] [--trace] [--psk-selftest]\n", argv[0]);
+            printf("       %s --bring-up|--tear-down [-i IFACE] [-e IFACE]\n", argv[0]);
+            printf("       %s --replay FILE [--port P] [--speed N] [--baseline FILE]\n"
+                   "                   [--save-baseline FILE] [--threshold PCT]\n", argv[0]);
+            printf("  --trace         record per-request spans, SIGUSR1 writes %s\n", TRACE_DUMP_FILE);
+            printf("  --psk-selftest  check the WPA2 PSK derivation and time it\n");
+            printf("  --bring-up      configure %s and the firewall for the portal\n", config.gw_interface);
+            printf("  --tear-down     remove the portal firewall and take %s down\n", config.gw_interface);
+            printf("  -i IFACE        access point interface (default %s)\n", config.gw_interface);
+            printf("  -e IFACE        uplink interface (default %s)\n", config.ext_interface);
+            printf("  --record FILE   log every connection and request to FILE\n");
+            printf("  --replay FILE   play a recorded trace against a running daemon\n");
+            printf("  --port P        port to replay against (default %d)\n", config.gw_port);
+            printf("  --speed N       replay N times faster than recorded (default 1)\n");
+            printf("  --baseline FILE fail when a route's p99 is worse than in FILE\n");
+            printf("  --save-baseline FILE  write this run's latencies as baseline\n");
+            printf("  --threshold PCT allowed p99 regression (default 20%%)\n");
             return 0;
         }
+        if (strcmp(argv[i], "--psk-selftest") == 0) {
+            return psk_selftest();
+        }
+        if (strcmp(argv[i], "--trace") == 0) {
+            trace_enable();
+            continue;
+        }
+        if (strcmp(argv[i], "--bring-up") == 0) {
+            action = RUN_BRING_UP;
+            continue;
+        }
+        if (strcmp(argv[i], "--tear-down") == 0) {
+            action = RUN_TEAR_DOWN;
+            continue;
+        }
+        if (strcmp(argv[i], "-i") == 0 && i + 1 < argc) {
+            config.gw_interface = argv[++i];
+            continue;
+        }
+        if (strcmp(argv[i], "-e") == 0 && i + 1 < argc) {
+            config.ext_interface = argv[++i];
+            continue;
+        }
+        if (strcmp(argv[i], "--record") == 0 && i + 1 < argc) {
+            record_file = argv[++i];
+            continue;
+        }
+        if (strcmp(argv[i], "--replay") == 0 && i + 1 < argc) {
+            replay.trace = argv[++i];
+            action = RUN_REPLAY;
+            continue;
+        }
+        if (strcmp(argv[i], "--port") == 0 && i + 1 < argc) {
+            replay.port = atoi(argv[++i]);
+            continue;
+        }
+        if (strcmp(argv[i], "--speed") == 0 && i + 1 < argc) {
+            replay.speed = atof(argv[++i]);
+            continue;
+        }
+        if (strcmp(argv[i], "--baseline") == 0 && i + 1 < argc) {
+            replay.baseline = argv[++i];
+            continue;
+        }
+        if (strcmp(argv[i], "--save-baseline") == 0 && i + 1 < argc) {
+            replay.save_baseline = argv[++i];
+            continue;
+        }
+        if (strcmp(argv[i], "--threshold") == 0 && i + 1 < argc) {
+            replay.threshold = atof(argv[++i]);
+            continue;
+        }
+        printf("Unknown option: %s\n", argv[i]);
+        return 1;
+    }
+
+    // Network setup for StartAP, no web server
+    if (action == RUN_BRING_UP) {
+        return ap_bring_up(&config) == 0 ? 0 : 1;
+    }
+    if (action == RUN_TEAR_DOWN) {
+        return ap_tear_down(&config) == 0 ? 0 : 1;
+    }
+
+    // Load generator against an already running daemon
+    if (action == RUN_REPLAY) {
+        if (replay.port <= 0) {
+            replay.port = config.gw_port;
+        }
+        if (replay.speed <= 0) {
+            printf("Error: --speed must be positive\n");
+            return 1;
+        }
+        return replay_run(&replay);
+    }
+
+    if (record_file && record_open(record_file) != 0) {
+        return 1;
     }
     
     printf("Starting simple-wifi %s...\n", WIFI_CONFIG_AP_VERSION);
@@ -79,6 +203,13 @@ int main(int argc, char **argv) {
     signal(SIGINT, termination_handler);  // Ctrl+C
     signal(SIGQUIT, termination_handler);
     signal(SIGALRM, termination_handler);  // Auto-exit after WiFi config
+    signal(SIGHUP, reload_handler);        // Re-render splash pages
+    signal(SIGUSR1, trace_dump_handler);   // Write trace spans
+
+    // Compile splash templates once, before the first client arrives
+    if (http_server_init() != 0) {
+        printf("WARNING: No splash page found in %s\n", config.webroot);
+    }
     
     // Start web server
     printf("Starting web server on port %d...\n", config.gw_port);
@@ -87,6 +218,8 @@ int main(int argc, char **argv) {
         config.gw_port,                   // Port
         NULL, NULL,                       // No connection restrictions
         libmicrohttpd_cb, NULL,          // Our request handler
+        MHD_OPTION_NOTIFY_CONNECTION, http_server_notify_connection, NULL,
+        MHD_OPTION_NOTIFY_COMPLETED, http_server_request_completed, NULL,
         MHD_OPTION_END                   // End of options
     );
     
@@ -99,8 +232,18 @@ int main(int argc, char **argv) {
     printf("Portal available at: http://%s/\n", config.gw_address);
     
     // HTTP daemon runs on its own threads - main() can just wait for termination signal
-    // No infinite loops needed - just wait once for a signal and exit cleanly
-    pause();  // Suspend until signal received, then termination_handler() will clean up and exit
+    // SIGHUP and SIGUSR1 only set flags, so keep waiting until termination_handler() exits
+    for (;;) {
+        pause();  // Suspend until signal received
+        if (trace_dump_requested) {
+            trace_dump_requested = 0;
+            if (trace_enabled) {
+                trace_dump(TRACE_DUMP_FILE);
+            } else {
+                printf("Tracing is off, start with --trace\n");
+            }
+        }
+    }
     
     // This should never be reached (termination_handler calls exit())
     // But if it somehow does, clean up properly
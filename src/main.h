@@ -20,9 +20,11 @@ typedef struct {
     int maxclients;
     char *gw_name;
     char *gw_interface;
+    char *ext_interface;
     int gw_port;
     char *webroot;
     char *splashpage;
+    char *splash_lang;
     int log_syslog;
     char *gw_address;
     char *gw_http_name;
@@ -0,0 +1,538 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+// Copyright (C) 2025 R. Moeijes
+
+/** @file psk.c
+ * @brief WPA2 pre-shared key derivation (PBKDF2-HMAC-SHA1)
+ * @author R. Moeijes
+ * @date 2025
+ * @version 1.0.0
+ * @copyright GPL v2+
+ *
+ * The PSK is PBKDF2-HMAC-SHA1(passphrase, ssid, 4096, 32 bytes), which is
+ * 16384 SHA-1 compressions. Deriving it here, while the portal is shutting
+ * down, saves NetworkManager/wpa_supplicant from doing it during each
+ * connect attempt.
+ *
+ * The inner and outer HMAC pads are hashed once, and every iteration after
+ * the first works on pre-padded 32-bit words, so one iteration costs two
+ * compressions and no byte shuffling. On arm64 the SHA-1 instructions are
+ * used when the CPU has them (HWCAP_SHA1), even in baseline armv8-a builds.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "psk.h"
+
+/* Built with +crypto the instructions are always there; plain arm64 builds
+ * compile that one function for +crypto and check the CPU at runtime. */
+#if defined(__ARM_NEON) && (defined(__ARM_FEATURE_SHA2) || defined(__ARM_FEATURE_CRYPTO))
+#include <arm_neon.h>
+#define HAVE_SHA1_ARMV8 1
+#define SHA1_ARMV8_TARGET
+#elif defined(__aarch64__) && defined(__linux__)
+#include <arm_neon.h>
+#include <sys/auxv.h>
+#define HAVE_SHA1_ARMV8 1
+#define SHA1_ARMV8_RUNTIME 1
+#ifdef __clang__
+#define SHA1_ARMV8_TARGET __attribute__((target("crypto")))
+#else
+#define SHA1_ARMV8_TARGET __attribute__((target("+crypto")))
+#endif
+#ifndef HWCAP_SHA1
+#define HWCAP_SHA1 (1 << 5)
+#endif
+#endif
+
+#define WPA_ITERATIONS 4096
+#define WPA_MAX_SSID 32
+
+#define SHA1_BLOCK 64
+#define SHA1_DIGEST 20
+#define SHA1_WORDS 5
+
+static const uint32_t sha1_iv[SHA1_WORDS] = {
+	0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0
+};
+
+#ifdef HAVE_SHA1_ARMV8
+
+/**
+ * @brief SHA-1 compression using the ARMv8 SHA1C/P/M instructions
+ *
+ * Each instruction does four rounds; the schedule for the next four-word
+ * group is built from the previous four with SHA1SU0/SU1.
+ */
+SHA1_ARMV8_TARGET
+static void sha1_compress_armv8(uint32_t state[SHA1_WORDS], const uint32_t block[16])
+{
+	static const uint32_t k[4] = { 0x5A827999, 0x6ED9EBA1, 0x8F1BBCDC, 0xCA62C1D6 };
+	uint32x4_t abcd, abcd_saved, wk, m[4];
+	uint32_t e, e_next;
+	int i;
+
+	abcd = vld1q_u32(state);
+	abcd_saved = abcd;
+	e = state[4];
+
+	for (i = 0; i < 4; i++) {
+		m[i] = vld1q_u32(block + 4 * i);
+	}
+
+	for (i = 0; i < 20; i++) {
+		wk = vaddq_u32(m[i % 4], vdupq_n_u32(k[i / 5]));
+		e_next = vsha1h_u32(vgetq_lane_u32(abcd, 0));
+
+		if (i < 5) {
+			abcd = vsha1cq_u32(abcd, e, wk);
+		} else if (i >= 10 && i < 15) {
+			abcd = vsha1mq_u32(abcd, e, wk);
+		} else {
+			abcd = vsha1pq_u32(abcd, e, wk);
+		}
+		e = e_next;
+
+		if (i < 16) {
+			m[i % 4] = vsha1su1q_u32(vsha1su0q_u32(m[i % 4], m[(i + 1) % 4], m[(i + 2) % 4]),
+			                         m[(i + 3) % 4]);
+		}
+	}
+
+	vst1q_u32(state, vaddq_u32(abcd_saved, abcd));
+	state[4] += e;
+}
+
+#endif /* HAVE_SHA1_ARMV8 */
+
+#define ROL(x, n) (((x) << (n)) | ((x) >> (32 - (n))))
+
+/* Message schedule kept in a 16-word ring */
+#define W(i) (w[(i) & 15] = ROL(w[((i) + 13) & 15] ^ w[((i) + 8) & 15] ^ \
+                                 w[((i) + 2) & 15] ^ w[(i) & 15], 1))
+
+#define R0(a, b, c, d, e, i) \
+	e += ((b & (c ^ d)) ^ d) + w[i] + 0x5A827999 + ROL(a, 5); b = ROL(b, 30)
+#define R1(a, b, c, d, e, i) \
+	e += ((b & (c ^ d)) ^ d) + W(i) + 0x5A827999 + ROL(a, 5); b = ROL(b, 30)
+#define R2(a, b, c, d, e, i) \
+	e += (b ^ c ^ d) + W(i) + 0x6ED9EBA1 + ROL(a, 5); b = ROL(b, 30)
+#define R3(a, b, c, d, e, i) \
+	e += (((b | c) & d) | (b & c)) + W(i) + 0x8F1BBCDC + ROL(a, 5); b = ROL(b, 30)
+#define R4(a, b, c, d, e, i) \
+	e += (b ^ c ^ d) + W(i) + 0xCA62C1D6 + ROL(a, 5); b = ROL(b, 30)
+
+/* Five rounds rotate the variables back into place */
+#define ROUNDS5(R, i) \
+	R(a, b, c, d, e, (i) + 0); R(e, a, b, c, d, (i) + 1); R(d, e, a, b, c, (i) + 2); \
+	R(c, d, e, a, b, (i) + 3); R(b, c, d, e, a, (i) + 4)
+
+/**
+ * @brief Portable, fully unrolled SHA-1 compression
+ */
+static void sha1_compress_c(uint32_t state[SHA1_WORDS], const uint32_t block[16])
+{
+	uint32_t a = state[0], b = state[1], c = state[2], d = state[3], e = state[4];
+	uint32_t w[16];
+
+	memcpy(w, block, sizeof(w));
+
+	ROUNDS5(R0, 0);  ROUNDS5(R0, 5);  ROUNDS5(R0, 10);
+	R0(a, b, c, d, e, 15); R1(e, a, b, c, d, 16); R1(d, e, a, b, c, 17);
+	R1(c, d, e, a, b, 18); R1(b, c, d, e, a, 19);
+	ROUNDS5(R2, 20); ROUNDS5(R2, 25); ROUNDS5(R2, 30); ROUNDS5(R2, 35);
+	ROUNDS5(R3, 40); ROUNDS5(R3, 45); ROUNDS5(R3, 50); ROUNDS5(R3, 55);
+	ROUNDS5(R4, 60); ROUNDS5(R4, 65); ROUNDS5(R4, 70); ROUNDS5(R4, 75);
+
+	state[0] += a;
+	state[1] += b;
+	state[2] += c;
+	state[3] += d;
+	state[4] += e;
+}
+
+typedef void (*sha1_compress_t)(uint32_t state[SHA1_WORDS], const uint32_t block[16]);
+
+static const struct sha1_core {
+	const char *name;
+	sha1_compress_t compress;
+} sha1_cores[] = {
+	{ "portable C", sha1_compress_c },
+#ifdef HAVE_SHA1_ARMV8
+	{ "ARMv8 SHA1 instructions", sha1_compress_armv8 },
+#endif
+};
+
+static const struct sha1_core *sha1_core = &sha1_cores[0];
+static sha1_compress_t sha1_compress = sha1_compress_c;
+static pthread_once_t sha1_once = PTHREAD_ONCE_INIT;
+
+static bool sha1_core_usable(const struct sha1_core *core)
+{
+#ifdef SHA1_ARMV8_RUNTIME
+	if (core->compress == sha1_compress_armv8) {
+		return (getauxval(AT_HWCAP) & HWCAP_SHA1) != 0;
+	}
+#endif
+	(void)core;
+	return true;
+}
+
+static void sha1_use_core(const struct sha1_core *core)
+{
+	sha1_core = core;
+	sha1_compress = core->compress;
+}
+
+/**
+ * @brief Pick the fastest core this CPU supports (the last usable one)
+ */
+static void sha1_select(void)
+{
+	int i;
+
+	for (i = sizeof(sha1_cores) / sizeof(sha1_cores[0]) - 1; i > 0; i--) {
+		if (sha1_core_usable(&sha1_cores[i])) {
+			break;
+		}
+	}
+	sha1_use_core(&sha1_cores[i]);
+}
+
+static uint32_t load_be32(const uint8_t *p)
+{
+	return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+static void store_be32(uint8_t *p, uint32_t v)
+{
+	p[0] = v >> 24;
+	p[1] = v >> 16;
+	p[2] = v >> 8;
+	p[3] = v;
+}
+
+/**
+ * @brief Hash @p data on top of @p state, which already covers @p prefix_len bytes
+ */
+static void sha1_finish(uint32_t state[SHA1_WORDS], const uint8_t *data, size_t len,
+                        uint64_t prefix_len)
+{
+	uint64_t bits = (prefix_len + len) * 8;
+	uint8_t tail[2 * SHA1_BLOCK] = {0};
+	uint32_t block[16];
+	size_t i, tail_len;
+
+	for (; len >= SHA1_BLOCK; data += SHA1_BLOCK, len -= SHA1_BLOCK) {
+		for (i = 0; i < 16; i++) {
+			block[i] = load_be32(data + 4 * i);
+		}
+		sha1_compress(state, block);
+	}
+
+	memcpy(tail, data, len);
+	tail[len] = 0x80;
+	tail_len = len + 9 <= SHA1_BLOCK ? SHA1_BLOCK : 2 * SHA1_BLOCK;
+	store_be32(tail + tail_len - 8, bits >> 32);
+	store_be32(tail + tail_len - 4, (uint32_t)bits);
+
+	for (data = tail; data < tail + tail_len; data += SHA1_BLOCK) {
+		for (i = 0; i < 16; i++) {
+			block[i] = load_be32(data + 4 * i);
+		}
+		sha1_compress(state, block);
+	}
+}
+
+/**
+ * @brief Hash one 64-byte HMAC key block XORed with @p pad
+ */
+static void hmac_pad_state(uint32_t state[SHA1_WORDS], const uint8_t key[SHA1_BLOCK], uint8_t pad)
+{
+	uint32_t block[16];
+	int i;
+
+	for (i = 0; i < 16; i++) {
+		block[i] = load_be32(key + 4 * i) ^ (pad * 0x01010101U);
+	}
+	memcpy(state, sha1_iv, sizeof(sha1_iv));
+	sha1_compress(state, block);
+}
+
+/**
+ * @brief Compute one PBKDF2 output block T_index
+ */
+static void pbkdf2_block(const uint32_t ipad[SHA1_WORDS], const uint32_t opad[SHA1_WORDS],
+                         const uint8_t *salt, size_t salt_len, uint32_t index,
+                         unsigned int iterations, uint32_t t[SHA1_WORDS])
+{
+	uint8_t first[256 + 4], digest[SHA1_DIGEST];
+	uint32_t u[16], state[SHA1_WORDS];
+	unsigned int n;
+	int i;
+
+	/* U1 = HMAC(P, S || INT(index)) */
+	memcpy(first, salt, salt_len);
+	store_be32(first + salt_len, index);
+
+	memcpy(state, ipad, sizeof(state));
+	sha1_finish(state, first, salt_len + 4, SHA1_BLOCK);
+	for (i = 0; i < SHA1_WORDS; i++) {
+		store_be32(digest + 4 * i, state[i]);
+	}
+	memcpy(state, opad, sizeof(state));
+	sha1_finish(state, digest, SHA1_DIGEST, SHA1_BLOCK);
+
+	/* U2..Uc: a 20-byte message after the pad block, padded once up front */
+	memset(u, 0, sizeof(u));
+	u[SHA1_WORDS] = 0x80000000;
+	u[15] = (SHA1_BLOCK + SHA1_DIGEST) * 8;
+
+	memcpy(u, state, sizeof(state));
+	memcpy(t, state, sizeof(state));
+
+	for (n = 1; n < iterations; n++) {
+		memcpy(state, ipad, sizeof(state));
+		sha1_compress(state, u);
+		memcpy(u, state, sizeof(state));
+
+		memcpy(state, opad, sizeof(state));
+		sha1_compress(state, u);
+		memcpy(u, state, sizeof(state));
+
+		for (i = 0; i < SHA1_WORDS; i++) {
+			t[i] ^= state[i];
+		}
+	}
+}
+
+void pbkdf2_sha1(const char *password, size_t password_len,
+                 const uint8_t *salt, size_t salt_len,
+                 unsigned int iterations, uint8_t *out, size_t out_len)
+{
+	uint8_t key[SHA1_BLOCK] = {0}, block[SHA1_DIGEST];
+	uint32_t ipad[SHA1_WORDS], opad[SHA1_WORDS], t[SHA1_WORDS];
+	uint32_t index;
+	size_t i, chunk;
+
+	if (salt_len > 256) {
+		return;
+	}
+	pthread_once(&sha1_once, sha1_select);
+
+	/* HMAC keys longer than a block are hashed first */
+	if (password_len > SHA1_BLOCK) {
+		uint32_t state[SHA1_WORDS];
+		memcpy(state, sha1_iv, sizeof(state));
+		sha1_finish(state, (const uint8_t *)password, password_len, 0);
+		for (i = 0; i < SHA1_WORDS; i++) {
+			store_be32(key + 4 * i, state[i]);
+		}
+	} else {
+		memcpy(key, password, password_len);
+	}
+
+	hmac_pad_state(ipad, key, 0x36);
+	hmac_pad_state(opad, key, 0x5c);
+
+	for (index = 1; out_len > 0; index++) {
+		pbkdf2_block(ipad, opad, salt, salt_len, index, iterations, t);
+		for (i = 0; i < SHA1_WORDS; i++) {
+			store_be32(block + 4 * i, t[i]);
+		}
+		chunk = out_len < SHA1_DIGEST ? out_len : SHA1_DIGEST;
+		memcpy(out, block, chunk);
+		out += chunk;
+		out_len -= chunk;
+	}
+
+	explicit_bzero(key, sizeof(key));
+	explicit_bzero(ipad, sizeof(ipad));
+	explicit_bzero(opad, sizeof(opad));
+}
+
+int wpa_passphrase_to_psk(const char *passphrase, const char *ssid, uint8_t psk[PSK_LEN])
+{
+	size_t len = strlen(passphrase);
+	size_t i;
+
+	if (len < 8 || len > 63 || strlen(ssid) > WPA_MAX_SSID) {
+		return -1;
+	}
+	for (i = 0; i < len; i++) {
+		if (passphrase[i] < 32 || passphrase[i] > 126) {
+			return -1;
+		}
+	}
+
+	pbkdf2_sha1(passphrase, len, (const uint8_t *)ssid, strlen(ssid),
+	            WPA_ITERATIONS, psk, PSK_LEN);
+	return 0;
+}
+
+/* Background derivation */
+struct psk_job {
+	char ssid[WPA_MAX_SSID + 1];
+	char passphrase[64];
+	psk_callback_t done;
+};
+
+static pthread_t psk_thread;
+static bool psk_running;
+
+static double elapsed_ms(const struct timespec *start)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start->tv_sec) * 1000.0 + (now.tv_nsec - start->tv_nsec) / 1e6;
+}
+
+static void psk_to_hex(const uint8_t psk[PSK_LEN], char hex[PSK_HEX_LEN + 1])
+{
+	static const char digits[] = "0123456789abcdef";
+	int i;
+
+	for (i = 0; i < PSK_LEN; i++) {
+		hex[2 * i] = digits[psk[i] >> 4];
+		hex[2 * i + 1] = digits[psk[i] & 0x0f];
+	}
+	hex[PSK_HEX_LEN] = '\0';
+}
+
+static void *psk_worker(void *arg)
+{
+	struct psk_job *job = arg;
+	char hex[PSK_HEX_LEN + 1];
+	uint8_t psk[PSK_LEN];
+	struct timespec start;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	if (wpa_passphrase_to_psk(job->passphrase, job->ssid, psk) == 0) {
+		psk_to_hex(psk, hex);
+		printf("Info: PSK for SSID=%s derived in %.1f ms\n", job->ssid, elapsed_ms(&start));
+		job->done(job->ssid, job->passphrase, hex);
+		explicit_bzero(psk, sizeof(psk));
+		explicit_bzero(hex, sizeof(hex));
+	}
+
+	explicit_bzero(job, sizeof(*job));
+	free(job);
+	return NULL;
+}
+
+/**
+ * @brief Check for a passphrase that already is a 256-bit hex key
+ */
+static bool is_hex_psk(const char *s)
+{
+	size_t i;
+
+	for (i = 0; i < PSK_HEX_LEN; i++) {
+		if (!((s[i] >= '0' && s[i] <= '9') || (s[i] >= 'a' && s[i] <= 'f') ||
+		      (s[i] >= 'A' && s[i] <= 'F'))) {
+			return false;
+		}
+	}
+	return s[PSK_HEX_LEN] == '\0';
+}
+
+void psk_derive_async(const char *ssid, const char *passphrase, psk_callback_t done)
+{
+	struct psk_job *job;
+	size_t len = strlen(passphrase);
+
+	if (len < 8 || len > 63 || strlen(ssid) > WPA_MAX_SSID || is_hex_psk(passphrase)) {
+		return;
+	}
+
+	/* A second /save replaces the first, but only after it is written */
+	psk_wait();
+
+	job = calloc(1, sizeof(*job));
+	if (!job) {
+		return;
+	}
+	strcpy(job->ssid, ssid);
+	strcpy(job->passphrase, passphrase);
+	job->done = done;
+
+	if (pthread_create(&psk_thread, NULL, psk_worker, job) != 0) {
+		/* No thread: derive inline, the 5 second exit delay covers it */
+		psk_worker(job);
+		return;
+	}
+	psk_running = true;
+}
+
+void psk_wait(void)
+{
+	if (psk_running) {
+		pthread_join(psk_thread, NULL);
+		psk_running = false;
+	}
+}
+
+int psk_selftest(void)
+{
+	/* IEEE 802.11i-2004, Annex H.4 */
+	static const struct {
+		const char *passphrase;
+		const char *ssid;
+		const char *psk;
+	} vectors[] = {
+		{ "password", "IEEE",
+		  "f42c6fc52df0ebef9ebb4b90b38a5f902e83fe1b135a70e23aed762e9710a12e" },
+		{ "ThisIsAPassword", "ThisIsASSID",
+		  "0dc0d6eb90555ed6419756b9a15ec3e3209b63df707dd508d14581f8982721af" },
+		{ "aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa", "ZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZZ",
+		  "becb93866bb8c3832cb777c2f559807c8c59afcb6eae734885001300a981cc62" },
+	};
+	const int rounds = 20;
+	char hex[PSK_HEX_LEN + 1];
+	uint8_t psk[PSK_LEN];
+	const struct sha1_core *selected;
+	struct timespec start;
+	int failed = 0;
+	size_t c, i;
+
+	pthread_once(&sha1_once, sha1_select);
+	selected = sha1_core;
+
+	/* Check every core this CPU can run, not only the one in use */
+	for (c = 0; c < sizeof(sha1_cores) / sizeof(sha1_cores[0]); c++) {
+		if (!sha1_core_usable(&sha1_cores[c])) {
+			printf("SHA-1 core: %s (not supported by this CPU)\n", sha1_cores[c].name);
+			continue;
+		}
+		sha1_use_core(&sha1_cores[c]);
+		printf("SHA-1 core: %s%s\n", sha1_core->name, sha1_core == selected ? " (in use)" : "");
+
+		for (i = 0; i < sizeof(vectors) / sizeof(vectors[0]); i++) {
+			wpa_passphrase_to_psk(vectors[i].passphrase, vectors[i].ssid, psk);
+			psk_to_hex(psk, hex);
+			if (strcmp(hex, vectors[i].psk) != 0) {
+				printf("FAIL: '%s' / '%s'\n  got      %s\n  expected %s\n",
+				       vectors[i].passphrase, vectors[i].ssid, hex, vectors[i].psk);
+				failed++;
+			} else {
+				printf("ok: '%s' / '%s'\n", vectors[i].passphrase, vectors[i].ssid);
+			}
+		}
+
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		for (i = 0; i < (size_t)rounds; i++) {
+			wpa_passphrase_to_psk(vectors[1].passphrase, vectors[1].ssid, psk);
+		}
+		printf("%.2f ms per PSK (%d rounds)\n", elapsed_ms(&start) / rounds, rounds);
+	}
+	sha1_use_core(selected);
+
+	return failed ? 1 : 0;
+}
@@ -0,0 +1,50 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+// Copyright (C) 2025 R. Moeijes
+
+/** @file psk.h
+ * @brief WPA2 pre-shared key derivation (PBKDF2-HMAC-SHA1)
+ * @author R. Moeijes
+ * @date 2025
+ * @copyright GPL v2+
+ */
+
+#ifndef _PSK_H_
+#define _PSK_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define PSK_LEN 32			/* 256-bit PMK */
+#define PSK_HEX_LEN (PSK_LEN * 2)	/* as accepted by NetworkManager */
+
+/** @brief Called with the derived key as 64 hex digits. */
+typedef void (*psk_callback_t)(const char *ssid, const char *passphrase, const char *psk_hex);
+
+/** @brief PBKDF2-HMAC-SHA1 (RFC 2898) with an output of any length. */
+void pbkdf2_sha1(const char *password, size_t password_len,
+                 const uint8_t *salt, size_t salt_len,
+                 unsigned int iterations, uint8_t *out, size_t out_len);
+
+/** @brief Derive the WPA2 PSK of a passphrase (IEEE 802.11i, 4096 rounds).
+ *
+ * Returns -1 when @p passphrase is not 8..63 printable ASCII characters.
+ */
+int wpa_passphrase_to_psk(const char *passphrase, const char *ssid, uint8_t psk[PSK_LEN]);
+
+/** @brief Derive the PSK on a background thread and hand it to @p done.
+ *
+ * Nothing happens for passphrases that cannot be converted, or that
+ * already are 64 hex digits.
+ */
+void psk_derive_async(const char *ssid, const char *passphrase, psk_callback_t done);
+
+/** @brief Wait for a pending psk_derive_async() to finish. */
+void psk_wait(void);
+
+/** @brief Check the IEEE 802.11i test vectors and time the derivation.
+ *
+ * Returns 0 when all vectors match.
+ */
+int psk_selftest(void);
+
+#endif /* _PSK_H_ */
@@ -0,0 +1,298 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+// Copyright (C) 2025 R. Moeijes
+
+/** @file record.c
+ * @brief Compact binary request traces for record and replay
+ * @author R. Moeijes
+ * @date 2025
+ * @version 1.0.0
+ * @copyright GPL v2+
+ *
+ * --record logs what real phones send: connection open/close, every
+ * request with its headers, and when the response completed. The replay
+ * mode (replay.c) plays such a trace back against a running daemon.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <microhttpd.h>
+
+#include "record.h"
+
+#define RECORD_MAX_STRING 4096
+#define RECORD_MAX_HEADERS 64
+
+bool record_enabled = false;
+
+static FILE *record_file;
+static pthread_mutex_t record_lock = PTHREAD_MUTEX_INITIALIZER;
+static uint64_t record_last_us;
+static uint64_t record_read_us;
+static int record_read_version;
+
+static void put_varint(uint64_t v)
+{
+	while (v >= 0x80) {
+		putc((v & 0x7f) | 0x80, record_file);
+		v >>= 7;
+	}
+	putc(v, record_file);
+}
+
+static void put_string(const char *s)
+{
+	size_t len = strlen(s);
+
+	if (len > RECORD_MAX_STRING) {
+		len = RECORD_MAX_STRING;
+	}
+	put_varint(len);
+	fwrite(s, 1, len, record_file);
+}
+
+/**
+ * @brief Write the common record start; the lock must be held
+ */
+static void put_record(enum record_type type, uint32_t conn, uint64_t now)
+{
+	uint64_t now_us = now / 1000;
+
+	/* The first record starts the clock */
+	if (record_last_us == 0 || now_us < record_last_us) {
+		record_last_us = now_us;
+	}
+
+	putc(type, record_file);
+	put_varint(now_us - record_last_us);
+	put_varint(conn);
+	record_last_us = now_us;
+}
+
+int record_open(const char *filename)
+{
+	record_file = fopen(filename, "wb");
+	if (!record_file) {
+		printf("Error: Failed to open %s for recording\n", filename);
+		return -1;
+	}
+
+	fwrite(RECORD_MAGIC, 1, strlen(RECORD_MAGIC), record_file);
+	putc(RECORD_VERSION, record_file);
+
+	record_enabled = true;
+	printf("Info: Recording requests to %s\n", filename);
+	return 0;
+}
+
+void record_connection_open(uint32_t conn, uint64_t now)
+{
+	pthread_mutex_lock(&record_lock);
+	put_record(RECORD_OPEN, conn, now);
+	pthread_mutex_unlock(&record_lock);
+}
+
+void record_connection_close(uint32_t conn, enum record_closer by, uint64_t now)
+{
+	pthread_mutex_lock(&record_lock);
+	put_record(RECORD_CLOSE, conn, now);
+	putc(by, record_file);
+	/* A power cut or SIGKILL then loses at most the open connections */
+	fflush(record_file);
+	pthread_mutex_unlock(&record_lock);
+}
+
+/**
+ * @brief Header iterator, the lock is held by record_request()
+ */
+static enum MHD_Result put_header(void *cls, enum MHD_ValueKind kind,
+                                  const char *key, const char *value)
+{
+	unsigned int *left = cls;
+
+	if (*left == 0) {
+		return MHD_NO;
+	}
+	(*left)--;
+
+	put_string(key);
+	put_string(value ? value : "");
+	return MHD_YES;
+}
+
+void record_request(uint32_t conn, struct MHD_Connection *connection,
+                    const char *method, const char *url, uint64_t now)
+{
+	enum record_method m = RECORD_OTHER;
+	unsigned int nheaders, left;
+
+	if (strcmp(method, "GET") == 0) {
+		m = RECORD_GET;
+	} else if (strcmp(method, "POST") == 0) {
+		m = RECORD_POST;
+	} else if (strcmp(method, "HEAD") == 0) {
+		m = RECORD_HEAD;
+	}
+
+	nheaders = MHD_get_connection_values(connection, MHD_HEADER_KIND, NULL, NULL);
+	if (nheaders > RECORD_MAX_HEADERS) {
+		nheaders = RECORD_MAX_HEADERS;
+	}
+
+	pthread_mutex_lock(&record_lock);
+	put_record(RECORD_REQUEST, conn, now);
+	putc(m, record_file);
+	put_string(url);
+	put_varint(nheaders);
+	left = nheaders;
+	MHD_get_connection_values(connection, MHD_HEADER_KIND, put_header, &left);
+	pthread_mutex_unlock(&record_lock);
+}
+
+void record_done(uint32_t conn, unsigned int status, uint64_t latency_ns, uint64_t now)
+{
+	pthread_mutex_lock(&record_lock);
+	put_record(RECORD_DONE, conn, now);
+	put_varint(status);
+	put_varint(latency_ns / 1000);
+	pthread_mutex_unlock(&record_lock);
+}
+
+/* --- reading --- */
+
+static int get_varint(FILE *file, uint64_t *v)
+{
+	int c, shift = 0;
+
+	*v = 0;
+	do {
+		c = getc(file);
+		if (c == EOF || shift > 63) {
+			return -1;
+		}
+		*v |= (uint64_t)(c & 0x7f) << shift;
+		shift += 7;
+	} while (c & 0x80);
+
+	return 0;
+}
+
+static char *get_string(FILE *file)
+{
+	uint64_t len;
+	char *s;
+
+	if (get_varint(file, &len) != 0 || len > RECORD_MAX_STRING) {
+		return NULL;
+	}
+	s = malloc(len + 1);
+	if (!s) {
+		return NULL;
+	}
+	if (fread(s, 1, len, file) != len) {
+		free(s);
+		return NULL;
+	}
+	s[len] = '\0';
+	return s;
+}
+
+int record_read_header(FILE *file)
+{
+	char magic[4];
+	int version;
+
+	if (fread(magic, 1, sizeof(magic), file) != sizeof(magic) ||
+	    memcmp(magic, RECORD_MAGIC, sizeof(magic)) != 0) {
+		return -1;
+	}
+	/* Version 1 traces only lack the closing side */
+	version = getc(file);
+	if (version < 1 || version > RECORD_VERSION) {
+		return -1;
+	}
+	record_read_version = version;
+	record_read_us = 0;
+	return 0;
+}
+
+int record_read(FILE *file, struct record_event *ev)
+{
+	uint64_t delta, v;
+	unsigned int i;
+	int type, c;
+
+	memset(ev, 0, sizeof(*ev));
+
+	type = getc(file);
+	if (type == EOF) {
+		return 0;
+	}
+	if (type < RECORD_OPEN || type > RECORD_CLOSE ||
+	    get_varint(file, &delta) != 0 || get_varint(file, &v) != 0) {
+		return -1;
+	}
+	record_read_us += delta;
+	ev->type = type;
+	ev->time_us = record_read_us;
+	ev->conn = v;
+
+	if (type == RECORD_REQUEST) {
+		c = getc(file);
+		if (c == EOF || c > RECORD_OTHER) {
+			return -1;
+		}
+		ev->method = c;
+		ev->url = get_string(file);
+		if (!ev->url || get_varint(file, &v) != 0 || v > RECORD_MAX_HEADERS) {
+			record_event_free(ev);
+			return -1;
+		}
+		ev->headers = calloc(v ? v : 1, sizeof(*ev->headers));
+		if (!ev->headers) {
+			record_event_free(ev);
+			return -1;
+		}
+		for (i = 0; i < v; i++) {
+			ev->headers[i].key = get_string(file);
+			ev->headers[i].value = get_string(file);
+			ev->nheaders = i + 1;
+			if (!ev->headers[i].key || !ev->headers[i].value) {
+				record_event_free(ev);
+				return -1;
+			}
+		}
+	} else if (type == RECORD_DONE) {
+		if (get_varint(file, &v) != 0) {
+			return -1;
+		}
+		ev->status = v;
+		if (get_varint(file, &v) != 0) {
+			return -1;
+		}
+		ev->latency_us = v;
+	} else if (type == RECORD_CLOSE && record_read_version >= 2) {
+		c = getc(file);
+		if (c == EOF || c > RECORD_CLOSED_BY_SERVER) {
+			return -1;
+		}
+		ev->closed_by = c;
+	}
+
+	return 1;
+}
+
+void record_event_free(struct record_event *ev)
+{
+	unsigned int i;
+
+	for (i = 0; i < ev->nheaders; i++) {
+		free(ev->headers[i].key);
+		free(ev->headers[i].value);
+	}
+	free(ev->headers);
+	free(ev->url);
+	ev->headers = NULL;
+	ev->url = NULL;
+	ev->nheaders = 0;
+}
@@ -0,0 +1,99 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+// Copyright (C) 2025 R. Moeijes
+
+/** @file record.h
+ * @brief Compact binary request traces for record and replay
+ * @author R. Moeijes
+ * @date 2025
+ * @copyright GPL v2+
+ *
+ * File layout: the magic "SWRT" and a version byte, then records of
+ *   type (1 byte), time since previous record in us (varint), connection (varint)
+ * followed by, for RECORD_REQUEST,
+ *   method (1 byte), url (string), header count (varint), key/value strings
+ * for RECORD_DONE
+ *   status (varint), latency in us (varint)
+ * and for RECORD_CLOSE (since version 2)
+ *   which side closed (1 byte).
+ * Strings are a varint length and the bytes; varints are LEB128.
+ */
+
+#ifndef _RECORD_H_
+#define _RECORD_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+struct MHD_Connection;
+
+#define RECORD_MAGIC "SWRT"
+#define RECORD_VERSION 2
+
+enum record_type {
+	RECORD_OPEN = 1,	/**< connection accepted */
+	RECORD_REQUEST,		/**< request headers received */
+	RECORD_DONE,		/**< response completed */
+	RECORD_CLOSE		/**< connection closed */
+};
+
+enum record_method {
+	RECORD_GET,
+	RECORD_POST,
+	RECORD_HEAD,
+	RECORD_OTHER
+};
+
+enum record_closer {
+	RECORD_CLOSED_BY_CLIENT,	/**< phone closed or half-closed the socket */
+	RECORD_CLOSED_BY_SERVER		/**< we closed: Connection: close, error, shutdown */
+};
+
+struct record_header {
+	char *key;
+	char *value;
+};
+
+/** @brief One decoded record, owned by the caller */
+struct record_event {
+	enum record_type type;
+	uint64_t time_us;	/**< since the start of the trace */
+	uint32_t conn;
+	enum record_method method;
+	char *url;
+	struct record_header *headers;
+	unsigned int nheaders;
+	unsigned int status;
+	uint32_t latency_us;
+	enum record_closer closed_by;
+};
+
+/** @brief Set by record_open() */
+extern bool record_enabled;
+
+/** @brief Start writing a trace. Returns 0 on success. */
+int record_open(const char *filename);
+
+/** @brief Log an accepted connection. */
+void record_connection_open(uint32_t conn, uint64_t now);
+
+/** @brief Log a closed connection and which side closed it. */
+void record_connection_close(uint32_t conn, enum record_closer by, uint64_t now);
+
+/** @brief Log a request with all its headers. */
+void record_request(uint32_t conn, struct MHD_Connection *connection,
+                    const char *method, const char *url, uint64_t now);
+
+/** @brief Log a completed response. */
+void record_done(uint32_t conn, unsigned int status, uint64_t latency_ns, uint64_t now);
+
+/** @brief Check the file header of a trace. Returns 0 when valid. */
+int record_read_header(FILE *file);
+
+/** @brief Read the next record. Returns 1 on success, 0 at the end, -1 on errors. */
+int record_read(FILE *file, struct record_event *ev);
+
+/** @brief Free the strings of a decoded record. */
+void record_event_free(struct record_event *ev);
+
+#endif /* _RECORD_H_ */
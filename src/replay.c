@@ -0,0 +1,810 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+// Copyright (C) 2025 R. Moeijes
+
+/** @file replay.c
+ * @brief Replay recorded request traces as a latency regression check
+ * @author R. Moeijes
+ * @date 2025
+ * @version 1.0.0
+ * @copyright GPL v2+
+ *
+ * Every recorded connection gets its own TCP connection, opened and
+ * closed at the recorded (optionally accelerated) time, and its requests
+ * are sent one after another with the recorded headers. This keeps the
+ * probe bursts, parallel asset fetches, preconnects without a request and
+ * idle keep-alives of real phones intact. A connection the phone closed is
+ * ended with a half-close, as the phone did. POSTs are skipped: their body is not recorded and /save
+ * would shut the daemon down.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include "record.h"
+#include "replay.h"
+
+#define REPLAY_TIMEOUT_US (10 * 1000000ULL)	/* per response */
+#define REPLAY_MAX_HEADER 8192
+#define REPLAY_MAX_ROUTES 8
+#define REPLAY_ROUTE_NAME 32
+
+enum conn_state {
+	CONN_PENDING,		/* not opened yet */
+	CONN_CONNECTING,
+	CONN_IDLE,		/* open, no request outstanding */
+	CONN_WAITING,		/* request sent, reading the response */
+	CONN_CLOSING,		/* half-closed, waiting for the server's close */
+	CONN_DONE
+};
+
+struct replay_req {
+	uint64_t time_us;
+	enum record_method method;
+	char *url;
+	struct record_header *headers;
+	unsigned int nheaders;
+};
+
+struct replay_conn {
+	uint64_t open_us;
+	uint64_t close_us;
+	bool closed;		/* close was recorded */
+	enum record_closer closed_by;
+	struct replay_req *reqs;
+	size_t nreqs, next;
+
+	enum conn_state state;
+	int fd;
+	bool opened;		/* connected at least once */
+	unsigned int served;	/* responses on the current socket */
+	bool retried;		/* next request already failed once on a reused socket */
+	uint64_t sent_ns;
+	char *header;		/* REPLAY_MAX_HEADER bytes while the socket is open */
+	size_t header_len;
+	bool header_done;
+	bool until_close;	/* no Content-Length: body ends at EOF */
+	long long body_left;
+};
+
+struct route_stats {
+	const char *name;
+	uint32_t *latency_us;
+	size_t count, cap;
+	double p50, p99, max;
+};
+
+struct baseline_route {
+	char name[REPLAY_ROUTE_NAME];
+	double p99;
+	bool seen;		/* this run had samples for it */
+};
+
+static struct route_stats routes[REPLAY_MAX_ROUTES];
+static int nroutes;
+static struct baseline_route baseline[REPLAY_MAX_ROUTES];
+static int nbaseline;
+static unsigned long replay_errors, replay_skipped;
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/**
+ * @brief Group URLs the way handle_request() dispatches them
+ */
+static const char *route_of(const char *url)
+{
+	static const char *const static_ext[] = {
+		"css", "js", "png", "jpg", "jpeg", "gif", "svg", "ico", NULL
+	};
+	size_t len = strcspn(url, "?");
+	const char *dot = NULL, *p;
+	int i;
+
+	if (len == 13 && strncmp(url, "/generate_204", 13) == 0) {
+		return "redirect";
+	}
+	for (p = url; p < url + len; p++) {
+		if (*p == '/') {
+			dot = NULL;
+		} else if (*p == '.') {
+			dot = p;
+		}
+	}
+	if (dot) {
+		if (url + len - dot - 1 == 4 && strncmp(dot + 1, "json", 4) == 0) {
+			return "networks";
+		}
+		for (i = 0; static_ext[i]; i++) {
+			if ((size_t)(url + len - dot - 1) == strlen(static_ext[i]) &&
+			    strncmp(dot + 1, static_ext[i], strlen(static_ext[i])) == 0) {
+				return "static";
+			}
+		}
+	}
+	return "splash";
+}
+
+static struct route_stats *get_route(const char *name)
+{
+	int i;
+
+	for (i = 0; i < nroutes; i++) {
+		if (strcmp(routes[i].name, name) == 0) {
+			return &routes[i];
+		}
+	}
+	if (nroutes == REPLAY_MAX_ROUTES) {
+		return NULL;
+	}
+	routes[nroutes].name = name;
+	return &routes[nroutes++];
+}
+
+static void add_latency(const char *route, uint64_t ns)
+{
+	struct route_stats *stats = get_route(route);
+	uint32_t *grown;
+
+	if (!stats) {
+		return;
+	}
+	if (stats->count == stats->cap) {
+		stats->cap = stats->cap ? stats->cap * 2 : 64;
+		grown = realloc(stats->latency_us, stats->cap * sizeof(*grown));
+		if (!grown) {
+			return;
+		}
+		stats->latency_us = grown;
+	}
+	stats->latency_us[stats->count++] = ns / 1000;
+}
+
+/* --- loading --- */
+
+/**
+ * @brief Find or create the connection for a recorded id
+ */
+static struct replay_conn *get_conn(struct replay_conn **conns, size_t *nconns, uint32_t id)
+{
+	struct replay_conn *grown;
+	size_t i;
+
+	if (id == 0) {
+		return NULL;
+	}
+	if (id > *nconns) {
+		grown = realloc(*conns, id * sizeof(**conns));
+		if (!grown) {
+			return NULL;
+		}
+		for (i = *nconns; i < id; i++) {
+			memset(&grown[i], 0, sizeof(grown[i]));
+			grown[i].fd = -1;
+			grown[i].state = CONN_DONE;	/* ids without events */
+		}
+		*conns = grown;
+		*nconns = id;
+	}
+	return &(*conns)[id - 1];
+}
+
+static int load_trace(const char *filename, struct replay_conn **conns, size_t *nconns)
+{
+	struct record_event ev;
+	struct replay_conn *conn;
+	FILE *file;
+	int ret;
+
+	file = fopen(filename, "rb");
+	if (!file) {
+		printf("Error: Cannot open %s\n", filename);
+		return -1;
+	}
+	if (record_read_header(file) != 0) {
+		printf("Error: %s is not a simple-wifi trace\n", filename);
+		fclose(file);
+		return -1;
+	}
+
+	while ((ret = record_read(file, &ev)) == 1) {
+		conn = get_conn(conns, nconns, ev.conn);
+		if (!conn) {
+			record_event_free(&ev);
+			continue;
+		}
+
+		switch (ev.type) {
+		case RECORD_OPEN:
+			conn->open_us = ev.time_us;
+			conn->state = CONN_PENDING;
+			break;
+		case RECORD_CLOSE:
+			conn->close_us = ev.time_us;
+			conn->closed = true;
+			conn->closed_by = ev.closed_by;
+			break;
+		case RECORD_REQUEST:
+			if (ev.method != RECORD_GET && ev.method != RECORD_HEAD) {
+				replay_skipped++;
+				break;
+			}
+			if (conn->nreqs % 16 == 0) {
+				struct replay_req *grown = realloc(conn->reqs,
+				                                   (conn->nreqs + 16) * sizeof(*grown));
+				if (!grown) {
+					break;
+				}
+				conn->reqs = grown;
+			}
+			/* The request takes over the strings */
+			conn->reqs[conn->nreqs].time_us = ev.time_us;
+			conn->reqs[conn->nreqs].method = ev.method;
+			conn->reqs[conn->nreqs].url = ev.url;
+			conn->reqs[conn->nreqs].headers = ev.headers;
+			conn->reqs[conn->nreqs].nheaders = ev.nheaders;
+			conn->nreqs++;
+			continue;
+		case RECORD_DONE:
+			break;
+		}
+		record_event_free(&ev);
+	}
+	fclose(file);
+
+	if (ret < 0) {
+		printf("Warning: %s is truncated, replaying what was read\n", filename);
+	}
+	return 0;
+}
+
+/* --- replaying --- */
+
+static void close_conn(struct replay_conn *conn, enum conn_state state)
+{
+	if (conn->fd >= 0) {
+		close(conn->fd);
+		conn->fd = -1;
+	}
+	free(conn->header);
+	conn->header = NULL;
+	conn->state = state;
+}
+
+static int open_conn(struct replay_conn *conn, const struct sockaddr_in *addr)
+{
+	/* Only open connections carry a header buffer, traces can hold many */
+	conn->header = malloc(REPLAY_MAX_HEADER);
+	conn->fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (!conn->header || conn->fd < 0) {
+		close_conn(conn, conn->state);
+		return -1;
+	}
+	if (connect(conn->fd, (const struct sockaddr *)addr, sizeof(*addr)) != 0 &&
+	    errno != EINPROGRESS) {
+		close_conn(conn, conn->state);
+		return -1;
+	}
+	conn->served = 0;
+	conn->opened = true;
+	conn->state = CONN_CONNECTING;
+	return 0;
+}
+
+static int send_all(int fd, const char *buf, size_t len)
+{
+	struct pollfd pfd = { .fd = fd, .events = POLLOUT };
+	size_t done = 0;
+
+	while (done < len) {
+		ssize_t n = send(fd, buf + done, len - done, MSG_NOSIGNAL);
+		if (n < 0 && (errno == EAGAIN || errno == EINTR)) {
+			poll(&pfd, 1, 100);
+			continue;
+		}
+		if (n <= 0) {
+			return -1;
+		}
+		done += n;
+	}
+	return 0;
+}
+
+static int send_request(struct replay_conn *conn)
+{
+	const struct replay_req *req = &conn->reqs[conn->next];
+	char buf[REPLAY_MAX_HEADER * 2];
+	unsigned int i;
+	int len;
+
+	len = snprintf(buf, sizeof(buf), "%s %s HTTP/1.1\r\n",
+	               req->method == RECORD_HEAD ? "HEAD" : "GET", req->url);
+	for (i = 0; i < req->nheaders && len < (int)sizeof(buf); i++) {
+		len += snprintf(buf + len, sizeof(buf) - len, "%s: %s\r\n",
+		                req->headers[i].key, req->headers[i].value);
+	}
+	if (len + 2 >= (int)sizeof(buf)) {
+		return -1;
+	}
+	len += snprintf(buf + len, sizeof(buf) - len, "\r\n");
+
+	conn->header_len = 0;
+	conn->header_done = false;
+	conn->sent_ns = now_ns();
+	if (send_all(conn->fd, buf, len) != 0) {
+		return -1;
+	}
+	conn->state = CONN_WAITING;
+	return 0;
+}
+
+/**
+ * @brief Parse the status line and Content-Length once the header is in
+ */
+static void parse_header(struct replay_conn *conn, size_t header_end)
+{
+	const struct replay_req *req = &conn->reqs[conn->next];
+	int status = 0;
+	char *p;
+
+	conn->header[header_end] = '\0';
+	sscanf(conn->header, "HTTP/%*s %d", &status);
+
+	conn->until_close = true;
+	conn->body_left = 0;
+	for (p = strstr(conn->header, "\r\n"); p; p = strstr(p + 2, "\r\n")) {
+		if (strncasecmp(p + 2, "Content-Length:", 15) == 0) {
+			conn->body_left = strtoll(p + 17, NULL, 10);
+			conn->until_close = false;
+		}
+	}
+	if (req->method == RECORD_HEAD || status == 204 || status == 304 ||
+	    (status >= 100 && status < 200)) {
+		conn->until_close = false;
+		conn->body_left = 0;
+	}
+	conn->header_done = true;
+}
+
+static void response_done(struct replay_conn *conn)
+{
+	add_latency(route_of(conn->reqs[conn->next].url), now_ns() - conn->sent_ns);
+	conn->next++;
+	conn->served++;
+	conn->retried = false;
+	conn->state = CONN_IDLE;
+}
+
+/**
+ * @brief Read what is available; returns -1 when the connection is gone
+ */
+static int read_response(struct replay_conn *conn)
+{
+	char buf[16384];
+	ssize_t n;
+
+	while ((n = recv(conn->fd, buf, sizeof(buf), 0)) > 0) {
+		size_t used = 0;
+
+		if (!conn->header_done) {
+			size_t copy = REPLAY_MAX_HEADER - 1 - conn->header_len;
+			char *end;
+
+			if (copy > (size_t)n) {
+				copy = n;
+			}
+			memcpy(conn->header + conn->header_len, buf, copy);
+			conn->header_len += copy;
+			conn->header[conn->header_len] = '\0';
+
+			end = strstr(conn->header, "\r\n\r\n");
+			if (!end) {
+				if (conn->header_len == REPLAY_MAX_HEADER - 1) {
+					return -1;
+				}
+				continue;
+			}
+			/* Bytes past the header in this read are body */
+			used = copy - (conn->header_len - (end + 4 - conn->header));
+			parse_header(conn, end + 4 - conn->header);
+		}
+
+		conn->body_left -= n - used;
+		if (!conn->until_close && conn->body_left <= 0) {
+			response_done(conn);
+			return 0;
+		}
+	}
+
+	if (n == 0) {
+		/* Server closed: that ends a response without Content-Length */
+		if (conn->header_done && conn->until_close) {
+			response_done(conn);
+		}
+		return -1;
+	}
+	return (errno == EAGAIN || errno == EINTR) ? 0 : -1;
+}
+
+/**
+ * @brief Check an idle keep-alive; returns -1 when the server closed it
+ */
+static int check_idle(struct replay_conn *conn)
+{
+	char buf[512];
+	ssize_t n;
+
+	/* Nothing is expected here, so anything but EOF is dropped */
+	while ((n = recv(conn->fd, buf, sizeof(buf), 0)) > 0);
+	if (n == 0) {
+		return -1;
+	}
+	return (errno == EAGAIN || errno == EINTR) ? 0 : -1;
+}
+
+/**
+ * @brief Handle a socket that broke while a request was outstanding
+ *
+ * A request on a reused keep-alive that gets no response byte back most
+ * likely crossed the server's close; it is sent again once on a new
+ * connection. Anything else is counted as an error.
+ */
+static void request_failed(struct replay_conn *conn)
+{
+	if (conn->served > 0 && conn->header_len == 0 && !conn->retried) {
+		conn->retried = true;
+	} else {
+		replay_errors++;
+		conn->next++;
+		conn->retried = false;
+	}
+	close_conn(conn, CONN_PENDING);
+}
+
+/**
+ * @brief Drive all connections until every one is done
+ */
+static void replay_loop(struct replay_conn *conns, size_t nconns,
+                        const struct sockaddr_in *addr, double speed)
+{
+	struct pollfd *pfds = calloc(nconns ? nconns : 1, sizeof(*pfds));
+	size_t *pidx = calloc(nconns ? nconns : 1, sizeof(*pidx));
+	uint64_t start = now_ns();
+
+	if (!pfds || !pidx) {
+		free(pfds);
+		free(pidx);
+		return;
+	}
+
+	for (;;) {
+		uint64_t trace_us = (uint64_t)((now_ns() - start) / 1000 * speed);
+		uint64_t wait_us = 100000;
+		size_t i, npfds = 0;
+		bool active = false;
+
+		for (i = 0; i < nconns; i++) {
+			struct replay_conn *conn = &conns[i];
+			uint64_t due;
+
+			/* A connection without requests is still opened once */
+			if (conn->state == CONN_PENDING && conn->opened &&
+			    conn->next >= conn->nreqs) {
+				conn->state = CONN_DONE;
+			}
+			if (conn->state == CONN_PENDING) {
+				/* After a server close, reopen when the next request is due */
+				due = conn->next > 0 ? conn->reqs[conn->next].time_us : conn->open_us;
+				if (trace_us >= due) {
+					if (open_conn(conn, addr) != 0) {
+						replay_errors++;
+						conn->state = CONN_DONE;
+					}
+				} else if ((due - trace_us) / speed < wait_us) {
+					wait_us = (due - trace_us) / speed;
+				}
+			}
+
+			if (conn->state == CONN_IDLE) {
+				if (conn->next < conn->nreqs) {
+					due = conn->reqs[conn->next].time_us;
+					if (trace_us >= due) {
+						if (send_request(conn) != 0) {
+							request_failed(conn);
+						}
+					} else if ((due - trace_us) / speed < wait_us) {
+						wait_us = (due - trace_us) / speed;
+					}
+				} else if (!conn->closed) {
+					close_conn(conn, CONN_DONE);
+				} else if (trace_us >= conn->close_us) {
+					/* Let the server see the phone's FIN; our own close
+					 * is seen as EOF in CONN_IDLE before this */
+					if (conn->closed_by == RECORD_CLOSED_BY_CLIENT &&
+					    shutdown(conn->fd, SHUT_WR) == 0) {
+						conn->sent_ns = now_ns();
+						conn->state = CONN_CLOSING;
+					} else {
+						close_conn(conn, CONN_DONE);
+					}
+				} else if ((conn->close_us - trace_us) / speed < wait_us) {
+					wait_us = (conn->close_us - trace_us) / speed;
+				}
+			}
+
+			if (conn->state == CONN_WAITING &&
+			    (now_ns() - conn->sent_ns) / 1000 > REPLAY_TIMEOUT_US) {
+				printf("Timeout: %s\n", conn->reqs[conn->next].url);
+				replay_errors++;
+				conn->next++;
+				conn->retried = false;
+				close_conn(conn, CONN_PENDING);
+			}
+			if (conn->state == CONN_CLOSING &&
+			    (now_ns() - conn->sent_ns) / 1000 > REPLAY_TIMEOUT_US) {
+				close_conn(conn, CONN_DONE);
+			}
+
+			if (conn->state != CONN_DONE) {
+				active = true;
+			}
+			if (conn->state == CONN_CONNECTING || conn->state == CONN_WAITING ||
+			    conn->state == CONN_IDLE || conn->state == CONN_CLOSING) {
+				pfds[npfds].fd = conn->fd;
+				pfds[npfds].events = conn->state == CONN_CONNECTING ? POLLOUT :
+				                     POLLIN | POLLRDHUP;
+				pidx[npfds++] = i;
+			}
+		}
+
+		if (!active) {
+			break;
+		}
+
+		if (poll(pfds, npfds, wait_us / 1000 + 1) <= 0) {
+			continue;
+		}
+
+		for (i = 0; i < npfds; i++) {
+			struct replay_conn *conn = &conns[pidx[i]];
+			int err = 0;
+			socklen_t len = sizeof(err);
+
+			if (!pfds[i].revents) {
+				continue;
+			}
+			if (conn->state == CONN_CONNECTING) {
+				getsockopt(conn->fd, SOL_SOCKET, SO_ERROR, &err, &len);
+				if (err) {
+					printf("Connect failed: %s\n", strerror(err));
+					replay_errors++;
+					close_conn(conn, CONN_DONE);
+				} else {
+					conn->state = CONN_IDLE;
+				}
+			} else if (conn->state == CONN_IDLE) {
+				/* Server closed the keep-alive: reconnect for the next request */
+				if (check_idle(conn) != 0) {
+					close_conn(conn, CONN_PENDING);
+				}
+			} else if (conn->state == CONN_CLOSING) {
+				if (check_idle(conn) != 0) {
+					close_conn(conn, CONN_DONE);
+				}
+			} else if (read_response(conn) != 0) {
+				if (conn->state == CONN_WAITING) {
+					request_failed(conn);
+				} else {
+					close_conn(conn, CONN_PENDING);
+				}
+			}
+		}
+	}
+
+	free(pfds);
+	free(pidx);
+}
+
+/* --- reporting --- */
+
+static int cmp_u32(const void *a, const void *b)
+{
+	uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static double percentile(const struct route_stats *stats, double p)
+{
+	size_t idx = (size_t)(p / 100.0 * (stats->count - 1) + 0.5);
+
+	return stats->latency_us[idx];
+}
+
+/**
+ * @brief Load a baseline file, one "route count p50 p99" line per route
+ *
+ * A gate that compared nothing must not pass, so a missing, empty or
+ * malformed file is an error.
+ */
+static int load_baseline(const char *filename)
+{
+	char line[256], name[REPLAY_ROUTE_NAME], extra;
+	unsigned long count;
+	double p50, p99;
+	int lineno = 0;
+	FILE *file;
+
+	file = fopen(filename, "r");
+	if (!file) {
+		printf("Error: Cannot open baseline %s\n", filename);
+		return -1;
+	}
+	while (fgets(line, sizeof(line), file)) {
+		lineno++;
+		if (line[strspn(line, " \t\r\n")] == '\0') {
+			continue;
+		}
+		if (sscanf(line, "%31s %lu %lf %lf %c", name, &count, &p50, &p99, &extra) != 4 ||
+		    p99 <= 0 || nbaseline == REPLAY_MAX_ROUTES) {
+			printf("Error: %s:%d is not a baseline line\n", filename, lineno);
+			fclose(file);
+			return -1;
+		}
+		strcpy(baseline[nbaseline].name, name);
+		baseline[nbaseline].p99 = p99;
+		nbaseline++;
+	}
+	fclose(file);
+
+	if (nbaseline == 0) {
+		printf("Error: Baseline %s has no routes\n", filename);
+		return -1;
+	}
+	return 0;
+}
+
+static struct baseline_route *baseline_find(const char *route)
+{
+	int i;
+
+	for (i = 0; i < nbaseline; i++) {
+		if (strcmp(baseline[i].name, route) == 0) {
+			return &baseline[i];
+		}
+	}
+	return NULL;
+}
+
+int replay_run(const struct replay_options *opts)
+{
+	struct replay_conn *conns = NULL;
+	struct sockaddr_in addr;
+	size_t nconns = 0, i, j;
+	unsigned long requests = 0, replayed = 0;
+	bool regressed = false, incomplete = false;
+	FILE *save = NULL;
+	int r;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(opts->port);
+	if (inet_pton(AF_INET, opts->host, &addr.sin_addr) != 1) {
+		printf("Error: Invalid address %s\n", opts->host);
+		return 1;
+	}
+
+	if (opts->baseline && load_baseline(opts->baseline) != 0) {
+		return 1;
+	}
+	if (load_trace(opts->trace, &conns, &nconns) != 0) {
+		return 1;
+	}
+	for (i = 0; i < nconns; i++) {
+		requests += conns[i].nreqs;
+	}
+	printf("Replaying %lu requests on %zu connections to %s:%d at %.1fx\n",
+	       requests, nconns, opts->host, opts->port, opts->speed);
+
+	replay_loop(conns, nconns, &addr, opts->speed);
+
+	if (opts->save_baseline) {
+		save = fopen(opts->save_baseline, "w");
+		if (!save) {
+			printf("Error: Cannot write %s\n", opts->save_baseline);
+			incomplete = true;
+		}
+	}
+
+	printf("%-10s %7s %10s %10s %10s %10s %8s\n",
+	       "route", "count", "p50 us", "p99 us", "max us", "base p99", "delta");
+	for (r = 0; r < nroutes; r++) {
+		struct route_stats *stats = &routes[r];
+		struct baseline_route *base;
+
+		if (stats->count == 0) {
+			continue;
+		}
+		qsort(stats->latency_us, stats->count, sizeof(uint32_t), cmp_u32);
+		stats->p50 = percentile(stats, 50);
+		stats->p99 = percentile(stats, 99);
+		stats->max = stats->latency_us[stats->count - 1];
+		replayed += stats->count;
+
+		base = baseline_find(stats->name);
+		if (base) {
+			double delta = (stats->p99 - base->p99) / base->p99 * 100.0;
+			bool bad = delta > opts->threshold;
+
+			printf("%-10s %7zu %10.0f %10.0f %10.0f %10.0f %+7.1f%%%s\n",
+			       stats->name, stats->count, stats->p50, stats->p99, stats->max,
+			       base->p99, delta, bad ? "  REGRESSION" : "");
+			base->seen = true;
+			regressed |= bad;
+		} else {
+			printf("%-10s %7zu %10.0f %10.0f %10.0f %10s %8s\n",
+			       stats->name, stats->count, stats->p50, stats->p99, stats->max, "-", "-");
+		}
+
+		if (save) {
+			fprintf(save, "%s %zu %.0f %.0f\n", stats->name, stats->count,
+			        stats->p50, stats->p99);
+		}
+		free(stats->latency_us);
+	}
+	if (save) {
+		fclose(save);
+		printf("Baseline written to %s\n", opts->save_baseline);
+	}
+
+	printf("%lu errors, %lu POST/other requests skipped\n", replay_errors, replay_skipped);
+
+	/* Routes the baseline knows but this run never measured */
+	for (r = 0; r < nbaseline; r++) {
+		if (!baseline[r].seen) {
+			printf("Error: No samples for baseline route '%s'\n", baseline[r].name);
+			incomplete = true;
+		}
+	}
+	if (replayed == 0) {
+		printf("Error: No requests were replayed\n");
+		incomplete = true;
+	}
+
+	for (i = 0; i < nconns; i++) {
+		for (j = 0; j < conns[i].nreqs; j++) {
+			struct record_event ev = {
+				.url = conns[i].reqs[j].url,
+				.headers = conns[i].reqs[j].headers,
+				.nheaders = conns[i].reqs[j].nheaders,
+			};
+			record_event_free(&ev);
+		}
+		free(conns[i].reqs);
+		close_conn(&conns[i], CONN_DONE);
+	}
+	free(conns);
+
+	if (regressed) {
+		printf("FAIL: p99 regressed more than %.0f%%\n", opts->threshold);
+		return 2;
+	}
+	return replay_errors || incomplete ? 1 : 0;
+}
@@ -0,0 +1,31 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+// Copyright (C) 2025 R. Moeijes
+
+/** @file replay.h
+ * @brief Replay recorded request traces as a latency regression check
+ * @author R. Moeijes
+ * @date 2025
+ * @copyright GPL v2+
+ */
+
+#ifndef _REPLAY_H_
+#define _REPLAY_H_
+
+struct replay_options {
+	const char *trace;		/**< file written by --record */
+	const char *host;		/**< daemon address, normally loopback */
+	int port;
+	double speed;			/**< 1.0 = original timing, 10 = ten times faster */
+	const char *baseline;		/**< compare against this baseline, may be NULL */
+	const char *save_baseline;	/**< write the results as new baseline, may be NULL */
+	double threshold;		/**< allowed p99 regression in percent */
+};
+
+/** @brief Replay a trace and report per-route latency.
+ *
+ * Returns 0 when everything was replayed and no route's p99 regressed
+ * past the threshold, 1 on errors and 2 on a regression.
+ */
+int replay_run(const struct replay_options *opts);
+
+#endif /* _REPLAY_H_ */
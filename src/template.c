@@ -0,0 +1,370 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+// Copyright (C) 2025 R. Moeijes
+
+/** @file template.c
+ * @brief Precompiled page templates and Accept-Language matching
+ * @author R. Moeijes
+ * @date 2025
+ * @version 1.0.0
+ * @copyright GPL v2+
+ *
+ * A template is read once and split into static text segments and slot
+ * references ({{name}}). Rendering only copies segments and escaped slot
+ * values into one buffer, so the caller can cache the result and hand the
+ * same bytes to every client until its inputs change.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "template.h"
+
+#define TPL_OPEN "{{"
+#define TPL_CLOSE "}}"
+#define TPL_MAX_NAME 32
+
+/**
+ * @brief Read a whole file into a NUL terminated buffer
+ */
+static char *read_file(const char *filename)
+{
+	struct stat stat_buf;
+	char *content;
+	size_t bytes_read = 0;
+	int fd;
+
+	fd = open(filename, O_RDONLY);
+	if (fd < 0) {
+		return NULL;
+	}
+
+	if (fstat(fd, &stat_buf) != 0 || !S_ISREG(stat_buf.st_mode)) {
+		close(fd);
+		return NULL;
+	}
+
+	content = calloc(stat_buf.st_size + 1, 1);
+	if (!content) {
+		close(fd);
+		return NULL;
+	}
+
+	while (bytes_read < (size_t)stat_buf.st_size) {
+		ssize_t ret_read = read(fd, content + bytes_read, stat_buf.st_size - bytes_read);
+		if (ret_read <= 0) {
+			break;
+		}
+		bytes_read += ret_read;
+	}
+	close(fd);
+	content[bytes_read] = '\0';
+
+	return content;
+}
+
+/**
+ * @brief Append a segment, merging adjacent static text
+ */
+static int add_segment(tpl_t *tpl, const char *text, size_t len, int slot)
+{
+	struct tpl_segment *segs;
+
+	if (slot < 0 && len == 0) {
+		return 0;
+	}
+
+	if (slot < 0 && tpl->nsegs > 0) {
+		struct tpl_segment *last = &tpl->segs[tpl->nsegs - 1];
+		if (last->slot < 0 && last->text + last->len == text) {
+			last->len += len;
+			return 0;
+		}
+	}
+
+	segs = realloc(tpl->segs, (tpl->nsegs + 1) * sizeof(*segs));
+	if (!segs) {
+		return -1;
+	}
+	tpl->segs = segs;
+	tpl->segs[tpl->nsegs].text = slot < 0 ? text : NULL;
+	tpl->segs[tpl->nsegs].len = slot < 0 ? len : 0;
+	tpl->segs[tpl->nsegs].slot = slot;
+	tpl->nsegs++;
+
+	return 0;
+}
+
+/**
+ * @brief Look up a slot by name, ignoring surrounding spaces
+ */
+static int find_slot(const tpl_t *tpl, const char *name, size_t len)
+{
+	int i;
+
+	while (len > 0 && *name == ' ') {
+		name++;
+		len--;
+	}
+	while (len > 0 && name[len - 1] == ' ') {
+		len--;
+	}
+
+	for (i = 0; i < tpl->nslots; i++) {
+		if (strlen(tpl->slots[i].name) == len &&
+		    strncmp(tpl->slots[i].name, name, len) == 0) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+int tpl_compile(tpl_t *tpl, const char *filename,
+                const struct tpl_slot *slots, int nslots)
+{
+	const char *walk, *open, *close;
+
+	memset(tpl, 0, sizeof(*tpl));
+	tpl->slots = slots;
+	tpl->nslots = nslots;
+
+	tpl->source = read_file(filename);
+	if (!tpl->source) {
+		return -1;
+	}
+
+	walk = tpl->source;
+	while ((open = strstr(walk, TPL_OPEN)) != NULL) {
+		const char *name = open + strlen(TPL_OPEN);
+		int slot = -1;
+
+		close = strstr(name, TPL_CLOSE);
+		if (close && close - name <= TPL_MAX_NAME) {
+			slot = find_slot(tpl, name, close - name);
+			if (slot < 0) {
+				printf("Warning: %s: unknown template variable '%.*s'\n",
+				       filename, (int)(close - name), name);
+			}
+		}
+
+		if (slot < 0) {
+			/* Not a slot, keep the braces as literal text */
+			if (add_segment(tpl, walk, name - walk, -1) != 0) {
+				goto fail;
+			}
+			walk = name;
+			continue;
+		}
+
+		if (add_segment(tpl, walk, open - walk, -1) != 0 ||
+		    add_segment(tpl, NULL, 0, slot) != 0) {
+			goto fail;
+		}
+		walk = close + strlen(TPL_CLOSE);
+	}
+
+	if (add_segment(tpl, walk, strlen(walk), -1) != 0) {
+		goto fail;
+	}
+
+	return 0;
+
+fail:
+	tpl_free(tpl);
+	return -1;
+}
+
+void tpl_free(tpl_t *tpl)
+{
+	free(tpl->segs);
+	free(tpl->source);
+	memset(tpl, 0, sizeof(*tpl));
+}
+
+/**
+ * @brief Escape one value; with @p out == NULL only the length is returned
+ */
+static size_t escape_value(char *out, const char *value, enum tpl_escape escape)
+{
+	const unsigned char *p;
+	size_t len = 0;
+
+	for (p = (const unsigned char *)value; *p; p++) {
+		const char *rep = NULL;
+
+		if (escape == TPL_ESCAPE_HTML) {
+			switch (*p) {
+			case '&': rep = "&amp;"; break;
+			case '<': rep = "&lt;"; break;
+			case '>': rep = "&gt;"; break;
+			case '"': rep = "&quot;"; break;
+			case '\'': rep = "&#39;"; break;
+			}
+		} else {
+			/* Keep the value from closing the script element */
+			switch (*p) {
+			case '&': rep = "\\u0026"; break;
+			case '<': rep = "\\u003c"; break;
+			case '>': rep = "\\u003e"; break;
+			}
+			/* U+2028 and U+2029 end a line in older JS parsers */
+			if (p[0] == 0xe2 && p[1] == 0x80 && (p[2] == 0xa8 || p[2] == 0xa9)) {
+				rep = p[2] == 0xa8 ? "\\u2028" : "\\u2029";
+				p += 2;
+			}
+		}
+
+		if (rep) {
+			size_t rep_len = strlen(rep);
+			if (out) {
+				memcpy(out + len, rep, rep_len);
+			}
+			len += rep_len;
+		} else {
+			if (out) {
+				out[len] = *p;
+			}
+			len++;
+		}
+	}
+
+	return len;
+}
+
+char *tpl_render(const tpl_t *tpl, const char *const values[], size_t *len)
+{
+	size_t i, total = 0, pos = 0;
+	char *out;
+
+	for (i = 0; i < tpl->nsegs; i++) {
+		const struct tpl_segment *seg = &tpl->segs[i];
+		if (seg->slot < 0) {
+			total += seg->len;
+		} else if (values[seg->slot]) {
+			total += escape_value(NULL, values[seg->slot], tpl->slots[seg->slot].escape);
+		}
+	}
+
+	out = malloc(total + 1);
+	if (!out) {
+		return NULL;
+	}
+
+	for (i = 0; i < tpl->nsegs; i++) {
+		const struct tpl_segment *seg = &tpl->segs[i];
+		if (seg->slot < 0) {
+			memcpy(out + pos, seg->text, seg->len);
+			pos += seg->len;
+		} else if (values[seg->slot]) {
+			pos += escape_value(out + pos, values[seg->slot], tpl->slots[seg->slot].escape);
+		}
+	}
+	out[pos] = '\0';
+
+	*len = pos;
+	return out;
+}
+
+/**
+ * @brief Parse the q parameter of one language range, in thousandths
+ *
+ * @p p points at the first ';'. Other parameters are skipped, and a
+ * range without q counts as q=1.
+ */
+static int parse_qvalue(const char *p, const char *end)
+{
+	int q, scale = 100;
+
+	for (;;) {
+		while (p < end && (*p == ';' || *p == ' ')) {
+			p++;
+		}
+		if (p >= end) {
+			return 1000;
+		}
+		if (end - p >= 2 && (*p == 'q' || *p == 'Q') && p[1] == '=') {
+			break;
+		}
+		while (p < end && *p != ';') {
+			p++;
+		}
+	}
+	p += 2;
+
+	q = (p < end && *p == '1') ? 1000 : 0;
+	if (p < end) {
+		p++;
+	}
+	if (p < end && *p == '.') {
+		for (p++; p < end && *p >= '0' && *p <= '9' && scale > 0; p++, scale /= 10) {
+			if (q < 1000) {
+				q += (*p - '0') * scale;
+			}
+		}
+	}
+
+	return q;
+}
+
+int tpl_match_locale(const char *accept_language,
+                     const char *const tags[], int ntags)
+{
+	const char *p = accept_language;
+	int best = -1, best_q = 0;
+
+	if (!p) {
+		return -1;
+	}
+
+	while (*p) {
+		const char *range, *range_end, *params, *end;
+		int i, q, match = -1;
+
+		while (*p == ' ' || *p == ',') {
+			p++;
+		}
+		if (!*p) {
+			break;
+		}
+
+		range = p;
+		end = strchr(p, ',');
+		if (!end) {
+			end = p + strlen(p);
+		}
+		params = memchr(range, ';', end - range);
+		range_end = params ? params : end;
+		while (range_end > range && range_end[-1] == ' ') {
+			range_end--;
+		}
+
+		/* Primary subtag only: "nl-BE" matches "nl" */
+		for (p = range; p < range_end && *p != '-'; p++);
+
+		if (p - range == 1 && *range == '*') {
+			match = 0;
+		} else {
+			for (i = 0; i < ntags; i++) {
+				if (strlen(tags[i]) == (size_t)(p - range) &&
+				    strncasecmp(tags[i], range, p - range) == 0) {
+					match = i;
+					break;
+				}
+			}
+		}
+
+		q = params ? parse_qvalue(params, end) : 1000;
+		if (match >= 0 && q > best_q) {
+			best = match;
+			best_q = q;
+		}
+
+		p = end;
+	}
+
+	return best;
+}
@@ -0,0 +1,68 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+// Copyright (C) 2025 R. Moeijes
+
+/** @file template.h
+ * @brief Precompiled page templates and Accept-Language matching
+ * @author R. Moeijes
+ * @date 2025
+ * @copyright GPL v2+
+ */
+
+#ifndef _TEMPLATE_H_
+#define _TEMPLATE_H_
+
+#include <stddef.h>
+
+/** @brief How a slot value is escaped when it is rendered. */
+enum tpl_escape {
+	TPL_ESCAPE_HTML,	/**< HTML text and attribute values */
+	TPL_ESCAPE_SCRIPT	/**< JSON/JS literal inside a <script> block */
+};
+
+/** @brief A named template variable, written as {{name}} in the page. */
+struct tpl_slot {
+	const char *name;
+	enum tpl_escape escape;
+};
+
+/** @brief One piece of a compiled template: static text or a slot reference. */
+struct tpl_segment {
+	const char *text;	/**< points into tpl_t::source, NULL for a slot */
+	size_t len;
+	int slot;		/**< index into the slot table, -1 for static text */
+};
+
+/** @brief A template compiled into static segments and slot references. */
+typedef struct {
+	char *source;
+	struct tpl_segment *segs;
+	size_t nsegs;
+	const struct tpl_slot *slots;
+	int nslots;
+} tpl_t;
+
+/** @brief Load and compile a template file. Returns 0 on success. */
+int tpl_compile(tpl_t *tpl, const char *filename,
+                const struct tpl_slot *slots, int nslots);
+
+/** @brief Release everything owned by a compiled template. */
+void tpl_free(tpl_t *tpl);
+
+/** @brief Render a compiled template with one raw value per slot.
+ *
+ * Values are escaped according to their slot definition; a NULL value
+ * renders as an empty string. Returns a malloc'd buffer (caller frees)
+ * and stores its length in @p len, or NULL on allocation failure.
+ */
+char *tpl_render(const tpl_t *tpl, const char *const values[], size_t *len);
+
+/** @brief Pick the best locale for an Accept-Language header.
+ *
+ * Only the primary language subtag is compared, case-insensitively, and
+ * q-values are honoured. Returns an index into @p tags, or -1 when
+ * nothing matches.
+ */
+int tpl_match_locale(const char *accept_language,
+                     const char *const tags[], int ntags);
+
+#endif /* _TEMPLATE_H_ */
@@ -0,0 +1,207 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+// Copyright (C) 2025 R. Moeijes
+
+/** @file trace.c
+ * @brief Optional per-request tracing with Chrome trace-event export
+ * @author R. Moeijes
+ * @date 2025
+ * @version 1.0.0
+ * @copyright GPL v2+
+ *
+ * Every thread that records a span gets its own ring buffer, so the
+ * request path never takes a lock. trace_dump() walks all buffers and
+ * writes JSON that chrome://tracing and Perfetto can open. Spans written
+ * while a dump is running may show up torn; that is accepted for a
+ * debugging aid.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+
+#include "trace.h"
+
+#define TRACE_BUFFER_SIZE 2048	/* spans per thread, oldest are overwritten */
+#define TRACE_DETAIL_LEN 40
+
+struct trace_record {
+	uint64_t start;
+	uint64_t dur;
+	uint32_t req;
+	uint16_t event;
+	char detail[TRACE_DETAIL_LEN];
+};
+
+struct trace_buffer {
+	struct trace_buffer *next;
+	pid_t tid;
+	unsigned long head;	/* total spans written, index is head % size */
+	struct trace_record records[TRACE_BUFFER_SIZE];
+};
+
+static const char *trace_event_names[TRACE_EVENT_COUNT] = {
+	[TRACE_ACCEPT]     = "accept",
+	[TRACE_CONNECTION] = "connection",
+	[TRACE_REQUEST]    = "request",
+	[TRACE_SANITIZE]   = "sanitize",
+	[TRACE_DISPATCH]   = "dispatch",
+	[TRACE_FILE]       = "file",
+	[TRACE_CACHE]      = "cache",
+	[TRACE_QUEUE]      = "queue",
+	[TRACE_COMPLETE]   = "complete",
+};
+
+bool trace_enabled = false;
+
+static struct trace_buffer *trace_buffers;
+static pthread_mutex_t trace_lock = PTHREAD_MUTEX_INITIALIZER;
+static uint32_t trace_last_request;
+
+static __thread struct trace_buffer *trace_local;
+static __thread uint32_t trace_current_request;
+
+void trace_enable(void)
+{
+	trace_enabled = true;
+	printf("Info: Tracing enabled, send SIGUSR1 to write %s\n", TRACE_DUMP_FILE);
+}
+
+uint64_t trace_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+uint32_t trace_new_request(void)
+{
+	return __atomic_add_fetch(&trace_last_request, 1, __ATOMIC_RELAXED);
+}
+
+void trace_set_request(uint32_t req)
+{
+	trace_current_request = req;
+}
+
+/**
+ * @brief Get this thread's buffer, registering it on first use
+ */
+static struct trace_buffer *trace_get_buffer(void)
+{
+	struct trace_buffer *buf;
+
+	if (trace_local) {
+		return trace_local;
+	}
+
+	buf = calloc(1, sizeof(*buf));
+	if (!buf) {
+		return NULL;
+	}
+	buf->tid = syscall(SYS_gettid);
+
+	pthread_mutex_lock(&trace_lock);
+	buf->next = trace_buffers;
+	trace_buffers = buf;
+	pthread_mutex_unlock(&trace_lock);
+
+	trace_local = buf;
+	return buf;
+}
+
+void trace_span(enum trace_event event, uint64_t start, const char *detail)
+{
+	struct trace_buffer *buf = trace_get_buffer();
+	struct trace_record *rec;
+	uint64_t end = trace_now();
+
+	if (!buf) {
+		return;
+	}
+
+	rec = &buf->records[buf->head % TRACE_BUFFER_SIZE];
+	rec->start = start;
+	rec->dur = end > start ? end - start : 0;
+	rec->req = trace_current_request;
+	rec->event = event;
+	if (detail) {
+		strncpy(rec->detail, detail, TRACE_DETAIL_LEN - 1);
+		rec->detail[TRACE_DETAIL_LEN - 1] = '\0';
+	} else {
+		rec->detail[0] = '\0';
+	}
+
+	__atomic_store_n(&buf->head, buf->head + 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief Write a string as a JSON string literal
+ */
+static void json_string(FILE *file, const char *s)
+{
+	fputc('"', file);
+	for (; *s; s++) {
+		unsigned char c = *s;
+		if (c == '"' || c == '\\') {
+			fprintf(file, "\\%c", c);
+		} else if (c < 0x20) {
+			fprintf(file, "\\u%04x", c);
+		} else {
+			fputc(c, file);
+		}
+	}
+	fputc('"', file);
+}
+
+int trace_dump(const char *filename)
+{
+	struct trace_buffer *buf;
+	unsigned long count = 0;
+	const char *sep = "";
+	pid_t pid = getpid();
+	FILE *file;
+
+	file = fopen(filename, "w");
+	if (!file) {
+		printf("Error: Failed to write trace file %s\n", filename);
+		return -1;
+	}
+
+	fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+
+	pthread_mutex_lock(&trace_lock);
+	for (buf = trace_buffers; buf; buf = buf->next) {
+		unsigned long head = __atomic_load_n(&buf->head, __ATOMIC_ACQUIRE);
+		unsigned long i = head > TRACE_BUFFER_SIZE ? head - TRACE_BUFFER_SIZE : 0;
+
+		for (; i < head; i++, count++) {
+			const struct trace_record *rec = &buf->records[i % TRACE_BUFFER_SIZE];
+
+			/* Chrome wants microseconds; keep the nanoseconds as decimals */
+			fprintf(file, "%s\n{\"name\":\"%s\",\"cat\":\"http\",\"ph\":\"X\","
+			        "\"ts\":%llu.%03u,\"dur\":%llu.%03u,\"pid\":%d,\"tid\":%d,"
+			        "\"args\":{\"req\":%u,\"detail\":",
+			        sep, trace_event_names[rec->event % TRACE_EVENT_COUNT],
+			        (unsigned long long)(rec->start / 1000), (unsigned)(rec->start % 1000),
+			        (unsigned long long)(rec->dur / 1000), (unsigned)(rec->dur % 1000),
+			        (int)pid, (int)buf->tid, rec->req);
+			json_string(file, rec->detail);
+			fprintf(file, "}}");
+			sep = ",";
+		}
+	}
+	pthread_mutex_unlock(&trace_lock);
+
+	fprintf(file, "\n]}\n");
+	fclose(file);
+
+	printf("Info: Wrote %lu trace spans to %s\n", count, filename);
+	return 0;
+}
@@ -0,0 +1,78 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+// Copyright (C) 2025 R. Moeijes
+
+/** @file trace.h
+ * @brief Optional per-request tracing and USDT probe points
+ * @author R. Moeijes
+ * @date 2025
+ * @copyright GPL v2+
+ */
+
+#ifndef _TRACE_H_
+#define _TRACE_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Static probes for bpftrace/perf, e.g.
+ *   bpftrace -e 'usdt:/usr/bin/simple-wifi:simple_wifi:request_start { printf("%s\n", str(arg1)); }'
+ * They compile to a nop when no tracer is attached. */
+#if defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define HAVE_USDT 1
+#endif
+#endif
+
+#ifdef HAVE_USDT
+#define TRACE_PROBE1(name, a)		DTRACE_PROBE1(simple_wifi, name, a)
+#define TRACE_PROBE2(name, a, b)	DTRACE_PROBE2(simple_wifi, name, a, b)
+#else
+#define TRACE_PROBE1(name, a)		do {} while (0)
+#define TRACE_PROBE2(name, a, b)	do {} while (0)
+#endif
+
+#define TRACE_DUMP_FILE "/tmp/simple-wifi-trace.json"
+
+/** @brief Span types, one per request processing phase */
+enum trace_event {
+	TRACE_ACCEPT,
+	TRACE_CONNECTION,
+	TRACE_REQUEST,
+	TRACE_SANITIZE,
+	TRACE_DISPATCH,
+	TRACE_FILE,
+	TRACE_CACHE,
+	TRACE_QUEUE,
+	TRACE_COMPLETE,
+	TRACE_EVENT_COUNT
+};
+
+/** @brief Set once at startup by --trace */
+extern bool trace_enabled;
+
+/** @brief Start recording spans. */
+void trace_enable(void);
+
+/** @brief Monotonic clock in nanoseconds. */
+uint64_t trace_now(void);
+
+/** @brief Allocate a new request id. */
+uint32_t trace_new_request(void);
+
+/** @brief Attribute following spans on this thread to a request. */
+void trace_set_request(uint32_t req);
+
+/** @brief Record a span from @p start until now in this thread's buffer. */
+void trace_span(enum trace_event event, uint64_t start, const char *detail);
+
+/** @brief Write all buffered spans as Chrome trace-event JSON. Returns 0 on success. */
+int trace_dump(const char *filename);
+
+/* Helpers that cost one branch when tracing is off */
+#define TRACE_BEGIN(var) \
+	uint64_t var = trace_enabled ? trace_now() : 0
+#define TRACE_END(event, var, detail) \
+	do { if (trace_enabled) trace_span(event, var, detail); } while (0)
+
+#endif /* _TRACE_H_ */